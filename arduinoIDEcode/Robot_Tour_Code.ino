@@ -1,15 +1,19 @@
-#include <Arduino_LSM6DS3.h> // Library for the IMU (adjust based on your IMU)
-
-// Variables for time tracking
-unsigned long prevTime = 0;
-
-// Variables for motion
-float acceleration = 0.0;
-float velocity = 0.0;
-float displacement = 0.0;
-
-// Constants for motion filtering
-float alpha = 0.85; // Filter constant (adjust as needed)
+#if defined(ARDUINO_ARCH_SAMD)
+#include <FlashStorage_SAMD.h> // the Nano 33 IoT has no EEPROM, this keeps one in flash
+#else
+#include <EEPROM.h>
+#endif
+#include "plan_format.h"
+#include "imu_fifo.h"
+#include "dead_reckoning.h"
+
+// accelerometer and gyro at IMU_RATE_HZ (imu_fifo.h)
+ImuFifo imu;
+unsigned long imuOverflowsSeen = 0;
+
+// Distance and speed for the moves (dead_reckoning.h)
+DeadReckoning deadReckoning;
+bool imuCalibrated = false;
 
 struct Motor {
   int f, b; // For the pins
@@ -26,7 +30,7 @@ int fwd = 1000;
 int bwd = 1000;
 int rt = 1000;
 int lt = 1000;
-int def = 1000;
+int trn = 1000; // 90 degree turn in place
 
 Motor upLeft(5, 4);
 Motor upRight(6, 7);
@@ -35,124 +39,356 @@ Motor downRight(9, 8);
 
 Motor motors[4] = {upLeft, downRight, upRight, downLeft};
 
+// One step of a paced run (see runSchedule)
+struct TimedStep {
+  char move;              // w/s/a/d forward/backward/left/right, q/e turn left/right
+  int pwm;
+  unsigned long driveMs;
+  unsigned long dwellMs;
+};
+
+// Moves waiting to run. forward(), turnLeft(), runSchedule() and the rest
+// only queue them; updateMotion() in loop() drives one after the other, so
+// the board keeps reading the IMU and Serial while the robot moves.
+struct Move {
+  char move;              // like TimedStep
+  int pwm;
+  float cells;            // w/s/a/d: drive until the IMU says this far, 0 = by time
+  unsigned long driveMs;  // by time: motors on this long, by distance: give up after this long
+  unsigned long dwellMs;  // stopped afterwards
+};
+
+const int MOVE_QUEUE_SIZE = PLAN_MAX_STEPS;
+Move moveQueue[MOVE_QUEUE_SIZE];
+int queueHead = 0;
+int queueCount = 0;
+
+enum MotionState { IDLE, DRIVING, DWELLING };
+MotionState motionState = IDLE;
+Move currentMove;
+unsigned long moveStartMs = 0; // when the current drive or dwell started
+char imuAxis = 'y';            // accelerometer axis the current move runs along
+
+// Plans uploaded from the gui (U key) come in over Serial and are kept in
+// EEPROM. After a reset the robot listens this long, then drives whatever
+// plan is stored.
+const unsigned long UPLOAD_WINDOW_MS = 3000;
+PlanReceiver planReceiver;
+bool listeningForUpload = true;
+unsigned long bootMs = 0;
+
 
 void setup() {
   Serial.begin(9600); //9600 bits per sec
 
 
   // Initialize the IMU
-  if (!IMU.begin()) {
+  if (!imu.begin()) {
     Serial.println("Failed to initialize IMU!");
     while (1); //pause evth
   }
   Serial.println("IMU initialized");
 
-  // Initialize time with amnt of time passed
-  prevTime = millis();
+  // the robot sits still through the upload window, long enough to measure the biases
+  deadReckoning.configure(IMU_RATE_HZ, IMU_G_PER_LSB, IMU_DPS_PER_LSB);
+  deadReckoning.calibrate();
 
   // Initialize motors
   for(int i = 0; i < 4; i++){
     pinMode(motors[i].f, OUTPUT);  // Set pins as outputs
     pinMode(motors[i].b, OUTPUT);
-    digitalWrite(motors[i].f, LOW);  // Start motors off 
+    digitalWrite(motors[i].f, LOW);  // Start motors off
     digitalWrite(motors[i].b, LOW);
     Serial.println("Initialized a motor");
   }
+
+  bootMs = millis();
 }
 
 void loop() {
-  // Here you can add your movement control logic or conditions
+  // A plan that arrives in the first few seconds is stored instead of
+  // driving the old one; reset to drive it. Later ones are stored too.
+  if (receivePlan()) {
+    listeningForUpload = false;
+  }
+  if (listeningForUpload && millis() - bootMs >= UPLOAD_WINDOW_MS) {
+    listeningForUpload = false;
+    runStoredPlan();
+  }
+
+  updateMotion();
+}
+
+// Robot Tour squares are 50 cm
+long cellMm = 500;
+// distance for the move in progress
+long distanceNeededMm = 500;
+// the robot rolls on for about this long at its speed when the motors cut,
+// so distance moves cut that much early
+long stopLeadMs = 150;
+// after a distance move, wait at most this long to stand still (and zero the
+// IMU's velocity) before the next one
+const unsigned long SETTLE_MAX_MS = 1000;
+
+// Heading hold: while driving w/s/a/d the wheels are trimmed, from the gyro,
+// to keep the robot pointing the way the turns so far say it should. This
+// replaces hand-tuned PWM trims (test_code.ino's 0.87) that broke whenever
+// the battery or the floor changed.
+bool headingHold = true;
+long targetHeadingMdeg = 0;     // counterclockwise, turnLeft() adds 90 degrees
+long headingKp = 10;            // PWM per degree off
+long headingKi = 20;            // PWM per degree second off
+long headingKd = 1;             // PWM per degree/s of turning
+const int MAX_HEADING_TRIM = 80;
+long headingErrorSum = 0;       // millidegrees * samples, this move
+long dutyOwed = 0;              // PWM * samples the trim took off a timed move, this move
+
+// Moves take a number of cells so the planner can send whole straight
+// segments (forward(2.5)) instead of stopping after every cell.
+void forward(float cells) {
+  queueMove('w', 255, cells, distanceTimeoutMs(cells), 0);
 }
 
-int distanceNeeded = 1.0;
+void backward(float cells) {
+  queueMove('s', 255, cells, distanceTimeoutMs(cells), 0);
+}
 
-void forward() {
-  for(int i = 0; i < 4; i++){
-    digitalWrite(motors[i].f, HIGH);
-    digitalWrite(motors[i].b, LOW);
-  }
+void right(float cells) {
+  queueMove('d', 255, cells, distanceTimeoutMs(cells), 0);
+}
 
-  settingIMU('y');
+void left(float cells) {
+  queueMove('a', 255, cells, distanceTimeoutMs(cells), 0);
+}
 
-  stopMotors();
+// Turn 90 degrees in place: left wheels one way, right wheels the other
+void turnRight() {
+  queueMove('e', 255, 0, trn, 0);
 }
 
-void backward() {
-  for(int i = 0; i < 4; i++){
-    digitalWrite(motors[i].f, LOW);
-    digitalWrite(motors[i].b, HIGH);
-  }
+void turnLeft() {
+  queueMove('q', 255, 0, trn, 0);
+}
 
-  settingIMU('y');
+// 10 seconds per cell before a distance move gives up
+unsigned long distanceTimeoutMs(float cells) {
+  return 10000 * max(1.0f, cells);
+}
 
-  stopMotors();
+bool queueMove(char move, int pwm, float cells, unsigned long driveMs, unsigned long dwellMs) {
+  if (queueCount == MOVE_QUEUE_SIZE) {
+    Serial.println("Move queue full");
+    return false;
+  }
+  moveQueue[(queueHead + queueCount) % MOVE_QUEUE_SIZE] = { move, pwm, cells, driveMs, dwellMs };
+  queueCount++;
+  return true;
 }
 
-void right() {
-  for(int i = 0; i < 2; i++){
-    digitalWrite(motors[i].f, HIGH);
-    digitalWrite(motors[i].b, LOW);
+// Nothing driving and nothing queued
+bool motionIdle() {
+  return motionState == IDLE && queueCount == 0;
+}
+
+// Call every pass of loop(). Ends the current move once it is far or long
+// enough, and starts the next one right away unless it asked to dwell. A
+// distance move first lets the robot come to a stop, so the IMU can zero
+// its velocity. Nothing starts before the IMU is calibrated, distance moves
+// couldn't tell when they got there.
+void updateMotion() {
+  sampleIMU();
+
+  unsigned long now = millis();
+  if (motionState == DRIVING) {
+    long rollMm = abs(deadReckoning.speedMmPerS(imuAxis)) * stopLeadMs / 1000;
+    bool arrived = currentMove.cells > 0 && deadReckoning.travelled(imuAxis, distanceNeededMm - rollMm);
+    if (arrived || now - moveStartMs >= currentMove.driveMs + owedDriveMs()) {
+      stopMotors();
+      moveStartMs = now;
+      motionState = DWELLING;
+    }
+  }
+  if (motionState == DWELLING && now - moveStartMs >= currentMove.dwellMs - min(currentMove.dwellMs, owedDriveMs())) {
+    bool settled = currentMove.cells == 0 || deadReckoning.still() || now - moveStartMs >= SETTLE_MAX_MS;
+    if (settled) {
+      motionState = IDLE;
+    }
   }
-  for(int i = 2; i < 4; i++){
-    digitalWrite(motors[i].f, LOW);
-    digitalWrite(motors[i].b, HIGH);
+  if (motionState == IDLE && queueCount > 0 && deadReckoning.calibrated()) {
+    Move next = moveQueue[queueHead];
+    queueHead = (queueHead + 1) % MOVE_QUEUE_SIZE;
+    queueCount--;
+    startMove(next, now);
   }
-  
-  settingIMU('x');
+}
 
-  stopMotors();
+void startMove(const Move& m, unsigned long now) {
+  currentMove = m;
+  distanceNeededMm = (long)(m.cells * cellMm);
+  imuAxis = (m.move == 'a' || m.move == 'd') ? 'x' : 'y';
+  deadReckoning.resetDistance();
+  if (m.move == 'q') {
+    targetHeadingMdeg += 90000;
+  } else if (m.move == 'e') {
+    targetHeadingMdeg -= 90000;
+  }
+  headingErrorSum = 0;
+  dutyOwed = 0;
+  setWheels(m.move, m.pwm, 0);
+  moveStartMs = now;
+  motionState = DRIVING;
 }
 
-void left() {
-  for(int i = 0; i < 2; i++){
-    digitalWrite(motors[i].f, LOW);
-    digitalWrite(motors[i].b, HIGH);
+// A timed move drives on by the duty its trim took (see holdHeading()), and
+// takes that time out of its dwell, so it still covers what the pacer expects
+unsigned long owedDriveMs() {
+  if (currentMove.cells > 0 || currentMove.pwm <= 0) {
+    return 0;
   }
-  for(int i = 2; i < 4; i++){
-    digitalWrite(motors[i].f, HIGH);
-    digitalWrite(motors[i].b, LOW);
+  return dutyOwed * 1000L / ((long)IMU_RATE_HZ * currentMove.pwm);
+}
+
+// trim > 0 turns the robot counterclockwise as it drives; the move gives up
+// as much speed as it takes so the trim always has room
+void setWheels(char move, int pwm, int trim) {
+  int base = min(pwm, 255 - abs(trim));
+  for (int i = 0; i < 4; i++) {
+    int c = wheelDirection(move, i) * base + wheelDirection('q', i) * trim;
+    analogWrite(motors[i].f, c > 0 ? c : 0);
+    analogWrite(motors[i].b, c < 0 ? -c : 0);
+  }
+}
+
+// PID on the gyro heading, once per IMU block (about 50 times a second)
+void holdHeading() {
+  char m = currentMove.move;
+  bool translating = m == 'w' || m == 's' || m == 'a' || m == 'd';
+  if (!headingHold || !translating || !deadReckoning.calibrated()) {
+    return;
   }
-  
-  settingIMU('x');
 
-  stopMotors();
+  long error = targetHeadingMdeg - deadReckoning.headingMilliDeg();
+  // no more integral than it takes to reach MAX_HEADING_TRIM on its own
+  long sumLimit = MAX_HEADING_TRIM * 1000L * IMU_RATE_HZ / headingKi;
+  headingErrorSum = constrain(headingErrorSum + error * IMU_BLOCK_SIZE, -sumLimit, sumLimit);
+  long trim = (headingKp * error + headingKi * headingErrorSum / IMU_RATE_HZ
+               - headingKd * deadReckoning.turnRateMilliDegPerS()) / 1000;
+  trim = constrain(trim, (long)-MAX_HEADING_TRIM, (long)MAX_HEADING_TRIM);
+  setWheels(m, currentMove.pwm, trim);
+
+  // Within the headroom above pwm the trim speeds one side up as much as it
+  // slows the other. Past it (all of it at 255) setWheels() slows the leading
+  // side only and the mean duty drops; a timed move keeps count and makes
+  // that up at the end (owedDriveMs()).
+  dutyOwed += (currentMove.pwm - min((long)currentMove.pwm, 255 - abs(trim))) * IMU_BLOCK_SIZE;
 }
 
+// analogWrite, not digitalWrite: on the SAMD core a pin setWheels() handed
+// to a timer keeps its duty through digitalWrite
 void stopMotors() {
   for(int i = 0; i < 4; i++){
-    digitalWrite(motors[i].f, LOW);
-    digitalWrite(motors[i].b, LOW);
+    analogWrite(motors[i].f, 0);
+    analogWrite(motors[i].b, 0);
+  }
+}
+
+// Feeds every sample the IMU took since the last call to the dead reckoning
+void sampleIMU() {
+  bool motorsOff = motionState != DRIVING;
+  ImuBlock block;
+  while (imu.read(block)) {
+    for (int i = 0; i < IMU_BLOCK_SIZE; i++) {
+      const ImuRawSample& sample = block.samples[i];
+      deadReckoning.update(sample.ax, sample.ay, sample.gz, motorsOff);
+    }
+    if (motionState == DRIVING) {
+      holdHeading();
+    }
   }
 
-  delay(def);
+  if (deadReckoning.calibrated() && !imuCalibrated) {
+    imuCalibrated = true;
+    Serial.println("IMU calibrated");
+  }
+  if (imu.overflows() != imuOverflowsSeen) {
+    imuOverflowsSeen = imu.overflows();
+    Serial.println("IMU FIFO overflowed, samples lost");
+  }
 }
 
-void settingIMU(char axis){
-  acceleration = displacement = velocity = 0;
-  
-  unsigned long timeout = millis() + 10000; // Timeout after 10 seconds
+// Paced runs. Start the gui with --target <seconds> and it prints a
+// schedule[] to paste in here; call runSchedule(schedule, sizeof(schedule) / sizeof(schedule[0]))
+// from setup(). Each step drives at its own PWM for driveMs, then stands
+// still for dwellMs. (TimedStep is at the top.)
+
+// +1 forward, -1 backward for motors[i] (upLeft, downRight, upRight, downLeft)
+int wheelDirection(char move, int i) {
+  switch (move) {
+    case 'w': return 1;
+    case 's': return -1;
+    case 'd': return i < 2 ? 1 : -1;
+    case 'a': return i < 2 ? -1 : 1;
+    case 'e': return (i == 0 || i == 3) ? 1 : -1;
+    case 'q': return (i == 0 || i == 3) ? -1 : 1;
+  }
+  return 0;
+}
 
-  while(abs(displacement) < distanceNeeded && millis() < timeout){
-    float xAcc, yAcc, zAcc;
-    // Read acceleration from the IMU
-    if (IMU.accelerationAvailable()) {
-      IMU.readAcceleration(xAcc, yAcc, zAcc);
+void runSchedule(const TimedStep* steps, int count) {
+  for (int s = 0; s < count; s++) {
+    if (!queueMove(steps[s].move, steps[s].pwm, 0, steps[s].driveMs, steps[s].dwellMs)) {
+      return;
     }
-    
-    // Filter acceleration based on axis
-    acceleration = (axis == 'y') ? alpha * acceleration + (1 - alpha) * yAcc : alpha * acceleration + (1 - alpha) * xAcc;
+  }
+}
 
-    // Calculate time delta (in seconds)
-    unsigned long currentTime = millis();
-    float deltaTime = (currentTime - prevTime) / 1000.0;
-    prevTime = currentTime;
+// -----------------------------------------------------------------------------
+// Uploaded plans (plan_format.h)
+
+// True once a new plan arrived and is stored. Answers the gui either way.
+bool receivePlan() {
+  while (Serial.available() > 0) {
+    PlanReceiver::Status status = planReceiver.feed(Serial.read(), millis());
+    if (status == PlanReceiver::FAILED) {
+      Serial.print("ERR ");
+      Serial.println(planReceiver.error());
+    } else if (status == PlanReceiver::DONE) {
+      storePlan(planReceiver.bytes(), planReceiver.size());
+      Serial.print("OK ");
+      Serial.println(planReceiver.header().count);
+      return true;
+    }
+  }
+  return false;
+}
 
-    // Integrate to find velocity
-    velocity += acceleration * deltaTime;
+void storePlan(const uint8_t* bytes, int size) {
+  for (int i = 0; i < size; i++) {
+    EEPROM.update(i, bytes[i]);
+  }
+#if defined(ARDUINO_ARCH_SAMD)
+  EEPROM.commit();
+#endif
+}
 
-    // Integrate velocity to find displacement
-    displacement += velocity * deltaTime;
+void runStoredPlan() {
+  // aligned, the header and steps are read in place
+  static union {
+    uint8_t bytes[PLAN_MAX_BYTES];
+    PlanHeader header;
+  } stored;
+  for (int i = 0; i < PLAN_MAX_BYTES; i++) {
+    stored.bytes[i] = EEPROM.read(i);
+  }
 
-    delay(50); // Delay for stability
+  const char* why = planError(stored.bytes, PLAN_MAX_BYTES);
+  if (why) {
+    Serial.print("No stored plan: ");
+    Serial.println(why);
+    return;
+  }
+  const PlanStep* steps = (const PlanStep*)(stored.bytes + sizeof(PlanHeader));
+  for (int i = 0; i < stored.header.count; i++) {
+    queueMove(PLAN_MOVE_KEY[steps[i].move], steps[i].pwm, 0, steps[i].driveMs, steps[i].dwellMs);
   }
 }
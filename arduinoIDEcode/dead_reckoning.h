@@ -0,0 +1,181 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// How far the robot got since the start of a move, from raw IMU samples.
+// Integer math only, the Nano 33 IoT has no FPU: accelerations go through
+// the trapezoid rule twice into exact sums, and only become millimeters when
+// asked. calibrate() measures the accelerometer and gyro biases while the
+// robot stands still, which also takes out whatever gravity leaks into x and
+// y. Whenever the motors are off and the samples go quiet the robot is
+// standing, so its velocity is zeroed (the drift of one move doesn't carry
+// into the next) and the biases are refined. Shared with the host replay
+// tool (sim/dead_reckoning_replay.cpp), so nothing but stdint in here.
+// -----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+class DeadReckoning {
+public:
+  // samples averaged for the biases, about a second at 416 Hz
+  static const int CALIBRATION_SAMPLES = 416;
+  // quiet this many samples in a row with the motors off = standing still (~100 ms)
+  static const int STILL_SAMPLES = 42;
+  // standing still nudges the biases 1/128 of the way per sample
+  static const int BIAS_SHIFT = 7;
+  // quiet is judged on an average over about 16 samples, single ones are too noisy
+  static const int SMOOTH_SHIFT = 4;
+
+  // The IMU's sample rate and scales. The only floating point in here.
+  void configure(int rateHz, float gPerLsb, float dpsPerLsb) {
+    const float G = 9.80665f;
+    float dt = 1.0f / rateHz;
+    // sums are raw units * 256, doubled by each trapezoid
+    velocityPerMmS = (int32_t)(2 * 256 / (gPerLsb * G * dt * 1000));
+    positionPerMm = (int64_t)(4 * 256 / (gPerLsb * G * dt * dt * 1000));
+    headingPerMilliDeg = (int64_t)(2 * 256 / (dpsPerLsb * dt * 1000));
+    gyroPerDps = (int32_t)(256 / dpsPerLsb);
+    // quiet: within 0.02 g and 2 degrees/s of the bias
+    stillAccel = (int32_t)(0.02f / gPerLsb) << 8;
+    stillGyro = (int32_t)(2.0f / dpsPerLsb) << 8;
+  }
+
+  // Measures the biases over the next CALIBRATION_SAMPLES; the robot has to
+  // stand still with the motors off, it starts over if it doesn't.
+  void calibrate() {
+    calibrating = true;
+    count = 0;
+  }
+
+  bool calibrated() const { return isCalibrated; }
+
+  // One IMU sample, raw. Calibration and zero velocity updates only happen
+  // with motorsOff, driving at a steady speed looks just as quiet.
+  void update(int16_t ax, int16_t ay, int16_t gz, bool motorsOff) {
+    if (calibrating) {
+      if (motorsOff) {
+        collect(ax, ay, gz);
+      } else {
+        count = 0;
+      }
+      return;
+    }
+    if (!isCalibrated) {
+      return;
+    }
+
+    int32_t x = ((int32_t)ax << 8) - biasX;
+    int32_t y = ((int32_t)ay << 8) - biasY;
+    int32_t g = ((int32_t)gz << 8) - biasG;
+
+    smoothX += (x - smoothX) >> SMOOTH_SHIFT;
+    smoothY += (y - smoothY) >> SMOOTH_SHIFT;
+    smoothG += (g - smoothG) >> SMOOTH_SHIFT;
+    bool quiet = motorsOff && abs32(smoothX) < stillAccel && abs32(smoothY) < stillAccel && abs32(smoothG) < stillGyro;
+    stillCount = quiet ? stillCount + 1 : 0;
+    if (stillCount >= STILL_SAMPLES) {
+      if (stillCount == STILL_SAMPLES) {
+        zeroVelocityCount++;
+      }
+      biasX += x >> BIAS_SHIFT;
+      biasY += y >> BIAS_SHIFT;
+      biasG += g >> BIAS_SHIFT;
+      velX = velY = 0;
+      prevX = prevY = prevG = 0;
+      return;
+    }
+
+    int32_t newVelX = velX + prevX + x;
+    int32_t newVelY = velY + prevY + y;
+    posX += (int64_t)velX + newVelX;
+    posY += (int64_t)velY + newVelY;
+    velX = newVelX;
+    velY = newVelY;
+    heading += (int64_t)prevG + g;
+    prevX = x;
+    prevY = y;
+    prevG = g;
+  }
+
+  // Start of a move: distances count from here. Speed and heading carry on.
+  void resetDistance() {
+    posX = posY = 0;
+  }
+
+  // At least mm along 'x' (right) or 'y' (forward) since resetDistance(), either way
+  bool travelled(char axis, int32_t mm) const {
+    int64_t p = axis == 'x' ? posX : posY;
+    return (p < 0 ? -p : p) >= (int64_t)mm * positionPerMm;
+  }
+
+  int32_t distanceMm(char axis) const { return (int32_t)((axis == 'x' ? posX : posY) / positionPerMm); }
+  int32_t speedMmPerS(char axis) const { return (axis == 'x' ? velX : velY) / velocityPerMmS; }
+  // counterclockwise since calibration
+  int32_t headingMilliDeg() const { return (int32_t)(heading / headingPerMilliDeg); }
+  // counterclockwise, over the last ~16 samples
+  int32_t turnRateMilliDegPerS() const { return (int32_t)((int64_t)smoothG * 1000 / gyroPerDps); }
+
+  bool still() const { return stillCount >= STILL_SAMPLES; }
+  unsigned long zeroVelocityUpdates() const { return zeroVelocityCount; }
+
+private:
+  int32_t velocityPerMmS = 1;
+  int64_t positionPerMm = 1;
+  int64_t headingPerMilliDeg = 1;
+  int32_t gyroPerDps = 1;
+  int32_t stillAccel = 0;
+  int32_t stillGyro = 0;
+
+  bool calibrating = false;
+  bool isCalibrated = false;
+  int count = 0;
+  int64_t sumX = 0, sumY = 0, sumG = 0;
+  int32_t lowX = 0, highX = 0, lowY = 0, highY = 0;   // of smoothX/Y, raw * 256
+
+  int32_t biasX = 0, biasY = 0, biasG = 0;   // raw * 256
+  int32_t prevX = 0, prevY = 0, prevG = 0;
+  int32_t smoothX = 0, smoothY = 0, smoothG = 0;
+  int32_t velX = 0, velY = 0;
+  int64_t posX = 0, posY = 0;
+  int64_t heading = 0;
+  int stillCount = 0;
+  unsigned long zeroVelocityCount = 0;
+
+  static int32_t abs32(int32_t v) { return v < 0 ? -v : v; }
+
+  void collect(int16_t ax, int16_t ay, int16_t gz) {
+    if (count == 0) {
+      sumX = sumY = sumG = 0;
+      smoothX = lowX = highX = (int32_t)ax << 8;
+      smoothY = lowY = highY = (int32_t)ay << 8;
+    }
+    smoothX += (((int32_t)ax << 8) - smoothX) >> SMOOTH_SHIFT;
+    smoothY += (((int32_t)ay << 8) - smoothY) >> SMOOTH_SHIFT;
+    lowX = smoothX < lowX ? smoothX : lowX;
+    highX = smoothX > highX ? smoothX : highX;
+    lowY = smoothY < lowY ? smoothY : lowY;
+    highY = smoothY > highY ? smoothY : highY;
+    // bumped: start over
+    if (highX - lowX > 2 * stillAccel || highY - lowY > 2 * stillAccel) {
+      count = 0;
+      return;
+    }
+    sumX += ax;
+    sumY += ay;
+    sumG += gz;
+    if (++count < CALIBRATION_SAMPLES) {
+      return;
+    }
+
+    biasX = (int32_t)(sumX * 256 / count);
+    biasY = (int32_t)(sumY * 256 / count);
+    biasG = (int32_t)(sumG * 256 / count);
+    calibrating = false;
+    isCalibrated = true;
+    velX = velY = 0;
+    posX = posY = 0;
+    heading = 0;
+    prevX = prevY = prevG = 0;
+    smoothX = smoothY = smoothG = 0;
+    stillCount = 0;
+  }
+};
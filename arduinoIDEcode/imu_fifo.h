@@ -0,0 +1,149 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// The LSM6DS3 at 416 Hz through its hardware FIFO. Arduino_LSM6DS3 only hands
+// out the newest sample, at 104 Hz, and the sketch's polling saw about 20 of
+// those a second. Here the chip queues every gyro and accelerometer sample
+// (about 1.6 s worth), poll() drains them over I2C in bursts and read() hands
+// them out IMU_BLOCK_SIZE at a time, in order. A sample's time follows from
+// its place in the stream, so each one is seen exactly once; the only way to
+// lose any is to not call read() for over a second, which overflows()
+// counts.
+// -----------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <Wire.h>
+
+const uint8_t LSM6DS3_ADDRESS = 0x6A;
+
+const int IMU_RATE_HZ = 416;
+const float IMU_PERIOD_S = 1.0f / IMU_RATE_HZ;
+const int IMU_BLOCK_SIZE = 8;     // about 19 ms
+
+// +-4 g and +-500 degrees/s full scale
+const float IMU_G_PER_LSB = 0.122f / 1000;
+const float IMU_DPS_PER_LSB = 17.5f / 1000;
+
+// One FIFO sample set, in the order the chip stores it
+struct ImuRawSample {
+  int16_t gx, gy, gz;
+  int16_t ax, ay, az;
+};
+
+struct ImuBlock {
+  unsigned long firstMicros;      // when samples[0] was taken; the rest follow every IMU_PERIOD_S
+  ImuRawSample samples[IMU_BLOCK_SIZE];
+};
+
+class ImuFifo {
+public:
+  // false if there's no LSM6DS3 on the bus
+  bool begin() {
+    Wire.begin();
+    Wire.setClock(400000);
+    uint8_t id = readRegister(WHO_AM_I);
+    if (id != 0x69 && id != 0x6A) {
+      return false;
+    }
+    writeRegister(CTRL3_C, 0x44);     // block data update, address auto-increment
+    writeRegister(CTRL1_XL, 0x68);    // 416 Hz, +-4 g
+    writeRegister(CTRL2_G, 0x64);     // 416 Hz, 500 degrees/s
+    writeRegister(FIFO_CTRL3, 0x09);  // gyro and accelerometer, every sample
+    restart();
+    return true;
+  }
+
+  // Moves whatever the FIFO holds into the block being filled. read() calls
+  // it too.
+  void poll() {
+    while (filled < IMU_BLOCK_SIZE) {
+      uint8_t status[4];
+      readRegisters(FIFO_STATUS1, status, 4);
+      int words = status[0] | ((status[1] & 0x0F) << 8);
+      int pattern = status[2] | ((status[3] & 0x03) << 8);
+      // overwritten samples, or somehow out of step with the x/y/z sets
+      if ((status[1] & 0x40) || pattern != 0) {
+        overflowCount++;
+        restart();
+        return;
+      }
+
+      int sets = min(words / 6, IMU_BLOCK_SIZE - filled);
+      if (sets == 0) {
+        return;
+      }
+      // FIFO_DATA_OUT_H rolls back to _L, so one read takes several sets
+      readRegisters(FIFO_DATA_OUT_L, (uint8_t*)&pending.samples[filled], sets * sizeof(ImuRawSample));
+      filled += sets;
+    }
+  }
+
+  // true with the next IMU_BLOCK_SIZE samples in `block`
+  bool read(ImuBlock& block) {
+    poll();
+    if (filled < IMU_BLOCK_SIZE) {
+      return false;
+    }
+    block = pending;
+    taken += IMU_BLOCK_SIZE;
+    pending.firstMicros = sampleMicros(taken);
+    filled = 0;
+    return true;
+  }
+
+  // times the FIFO had to be restarted and samples were lost
+  unsigned long overflows() const { return overflowCount; }
+
+private:
+  static const uint8_t FIFO_CTRL3 = 0x08;
+  static const uint8_t FIFO_CTRL5 = 0x0A;
+  static const uint8_t WHO_AM_I = 0x0F;
+  static const uint8_t CTRL1_XL = 0x10;
+  static const uint8_t CTRL2_G = 0x11;
+  static const uint8_t CTRL3_C = 0x12;
+  static const uint8_t FIFO_STATUS1 = 0x3A;
+  static const uint8_t FIFO_DATA_OUT_L = 0x3E;
+
+  ImuBlock pending;
+  int filled = 0;
+  unsigned long startMicros = 0;
+  unsigned long taken = 0;        // samples handed out since restart()
+  unsigned long overflowCount = 0;
+
+  // the FIFO's n-th sample (from 0) arrives one period after the one before
+  unsigned long sampleMicros(unsigned long n) const {
+    return startMicros + (unsigned long)((uint64_t)(n + 1) * 1000000 / IMU_RATE_HZ);
+  }
+
+  void restart() {
+    writeRegister(FIFO_CTRL5, 0x00);  // bypass empties it
+    writeRegister(FIFO_CTRL5, 0x36);  // continuous, 416 Hz
+    startMicros = micros();
+    taken = 0;
+    filled = 0;
+    pending.firstMicros = sampleMicros(0);
+  }
+
+  void writeRegister(uint8_t reg, uint8_t value) {
+    Wire.beginTransmission(LSM6DS3_ADDRESS);
+    Wire.write(reg);
+    Wire.write(value);
+    Wire.endTransmission();
+  }
+
+  uint8_t readRegister(uint8_t reg) {
+    uint8_t value = 0;
+    readRegisters(reg, &value, 1);
+    return value;
+  }
+
+  void readRegisters(uint8_t reg, uint8_t* data, int length) {
+    Wire.beginTransmission(LSM6DS3_ADDRESS);
+    Wire.write(reg);
+    Wire.endTransmission(false);
+    Wire.requestFrom(LSM6DS3_ADDRESS, (uint8_t)length);
+    for (int i = 0; i < length; i++) {
+      data[i] = Wire.available() ? Wire.read() : 0;
+    }
+  }
+};
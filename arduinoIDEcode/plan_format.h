@@ -0,0 +1,150 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Binary plan: what the gui uploads over serial and the robot keeps in
+// EEPROM, so a new route doesn't need a reflash. Shared by the sketch, the
+// gui and fake_robot, so nothing but stdint in here. Fields are little-endian
+// like every board and PC we build for.
+//
+//   PlanHeader                 8 bytes
+//   PlanStep steps[count]      8 bytes each
+//
+// checksum is CRC-16/CCITT-FALSE over version, count and the steps. After a
+// plan arrives the robot answers "OK <count>\n" once it is stored, or
+// "ERR <why>\n".
+// -----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+
+const char PLAN_MAGIC[4] = { 'R', 'T', 'P', 'L' };
+const uint8_t PLAN_FORMAT_VERSION = 1;
+const int PLAN_MAX_STEPS = 64;
+
+// a gap this long in the middle of a plan drops it
+const unsigned long PLAN_BYTE_TIMEOUT_MS = 500;
+
+struct PlanHeader {
+  char magic[4];
+  uint8_t version;
+  uint8_t count;           // steps that follow
+  uint16_t checksum;
+};
+
+// One command of a paced schedule (TimedCommand in the gui)
+struct PlanStep {
+  uint8_t move;            // forward, backward, left, right, turn left, turn right
+  uint8_t pwm;
+  uint16_t distance;       // cells * 100, 0 for turns
+  uint16_t driveMs;        // motors on
+  uint16_t dwellMs;        // stopped afterwards
+};
+
+static_assert(sizeof(PlanHeader) == 8 && sizeof(PlanStep) == 8, "plan layout changed");
+
+const int PLAN_MAX_BYTES = sizeof(PlanHeader) + PLAN_MAX_STEPS * sizeof(PlanStep);
+
+// the sketch's single-letter name for each PlanStep::move
+const char PLAN_MOVE_KEY[6] = { 'w', 's', 'a', 'd', 'q', 'e' };
+
+inline uint16_t planCrc(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+inline uint16_t planChecksum(const PlanHeader& header, const PlanStep* steps) {
+  uint8_t versionCount[2] = { header.version, header.count };
+  uint16_t crc = planCrc(versionCount, 2);
+  return planCrc((const uint8_t*)steps, header.count * sizeof(PlanStep), crc);
+}
+
+// Whole plan at `bytes` (up to `length` bytes) is well formed and intact.
+// Returns why not, or nullptr.
+inline const char* planError(const uint8_t* bytes, int length) {
+  if (length < (int)sizeof(PlanHeader)) return "short";
+  const PlanHeader& header = *(const PlanHeader*)bytes;
+  for (int i = 0; i < 4; i++) {
+    if (header.magic[i] != PLAN_MAGIC[i]) return "not a plan";
+  }
+  if (header.version != PLAN_FORMAT_VERSION) return "version";
+  if (header.count > PLAN_MAX_STEPS) return "too long";
+  if (length < (int)(sizeof(PlanHeader) + header.count * sizeof(PlanStep))) return "short";
+  for (int i = 0; i < header.count; i++) {
+    if (((const PlanStep*)(bytes + sizeof(PlanHeader)))[i].move >= 6) return "bad move";
+  }
+  if (planChecksum(header, (const PlanStep*)(bytes + sizeof(PlanHeader))) != header.checksum) return "checksum";
+  return nullptr;
+}
+
+// Takes a plan one byte at a time, the way it comes off a serial port.
+// Anything before the magic is skipped; a plan that stalls for
+// PLAN_BYTE_TIMEOUT_MS is dropped. feed() says DONE once a whole plan
+// checked out (bytes() / size() hold it) and FAILED with error() if it
+// didn't; the next byte starts over either way.
+class PlanReceiver {
+public:
+  enum Status { WAITING, RECEIVING, DONE, FAILED };
+
+  Status feed(uint8_t b, unsigned long nowMs) {
+    if (finished || (received > 0 && nowMs - lastByteMs > PLAN_BYTE_TIMEOUT_MS)) {
+      received = 0;
+      finished = false;
+    }
+    lastByteMs = nowMs;
+
+    if (received < 4) {
+      if ((char)b != PLAN_MAGIC[received]) {
+        received = 0;
+      }
+      if ((char)b == PLAN_MAGIC[received]) {
+        store.bytes[received++] = b;
+      }
+      return received > 0 ? RECEIVING : WAITING;
+    }
+
+    store.bytes[received++] = b;
+    if (received == (int)sizeof(PlanHeader)) {
+      if (store.header.version != PLAN_FORMAT_VERSION) return fail("version");
+      if (store.header.count > PLAN_MAX_STEPS) return fail("too long");
+    }
+    if (received < size()) {
+      return RECEIVING;
+    }
+
+    why = planError(store.bytes, received);
+    finished = true;
+    return why ? FAILED : DONE;
+  }
+
+  const uint8_t* bytes() const { return store.bytes; }
+  const PlanHeader& header() const { return store.header; }
+  const PlanStep* steps() const { return (const PlanStep*)(store.bytes + sizeof(PlanHeader)); }
+  const char* error() const { return why ? why : ""; }
+
+  // bytes in the whole plan, once the header is in
+  int size() const {
+    if (received < (int)sizeof(PlanHeader)) return (int)sizeof(PlanHeader);
+    return (int)(sizeof(PlanHeader) + store.header.count * sizeof(PlanStep));
+  }
+
+private:
+  union {
+    uint8_t bytes[PLAN_MAX_BYTES];
+    PlanHeader header;
+  } store;
+  int received = 0;
+  bool finished = false;
+  unsigned long lastByteMs = 0;
+  const char* why = nullptr;
+
+  Status fail(const char* reason) {
+    why = reason;
+    finished = true;
+    return FAILED;
+  }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Just the Arduino core the sketches use, on a virtual clock (see sim.h).
+// -----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "sim.h"
+
+using std::abs;
+using std::max;
+using std::min;
+
+template <typename T, typename L, typename H>
+T constrain(T value, L low, H high) { return value < low ? (T)low : (value > high ? (T)high : value); }
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// Nano 33 IoT numbering
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+void setup();
+void loop();
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void analogWrite(int pin, int value);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Serial: output goes to stdout a line at a time with the robot's time in
+// front, input is whatever --serial gave.
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  int available();
+  int read();
+  size_t write(uint8_t b);
+
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(unsigned char n);
+  size_t print(int n);
+  size_t print(unsigned int n);
+  size_t print(long n);
+  size_t print(unsigned long n);
+  size_t print(double n, int digits = 2);
+
+  size_t println();
+  template <typename T>
+  size_t println(T value) { size_t n = print(value); return n + println(); }
+  size_t println(double n, int digits) { size_t k = print(n, digits); return k + println(); }
+
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
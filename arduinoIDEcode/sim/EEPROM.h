@@ -0,0 +1,24 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// EEPROM in memory, loaded from and saved to --eeprom (see sim.h).
+// -----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+const int SIM_EEPROM_SIZE = 1024;
+
+class EEPROMClass {
+public:
+  uint8_t read(int address) const;
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value) { if (read(address) != value) write(address, value); }
+  uint16_t length() const { return SIM_EEPROM_SIZE; }
+
+  uint8_t bytes[SIM_EEPROM_SIZE];
+  bool changed = false;
+
+  EEPROMClass();
+};
+
+extern EEPROMClass EEPROM;
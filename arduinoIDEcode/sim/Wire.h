@@ -0,0 +1,36 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// I2C with an LSM6DS3 on it at 0x6A, registers and FIFO included, fed by the
+// drive model (sim_lsm6ds3.cpp). Transfers take bus time at the set clock.
+// -----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+
+class TwoWire {
+public:
+  void begin() {}
+  void setClock(uint32_t hz) { clockHz = hz; }
+
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t b);
+  // 0 when the device answered, 2 if nothing is at the address
+  uint8_t endTransmission(bool stop = true);
+
+  uint8_t requestFrom(uint8_t address, size_t count, bool stop = true);
+  int available();
+  int read();
+
+private:
+  uint32_t clockHz = 100000;
+  uint8_t address = 0;
+  uint8_t txBytes = 0;
+  uint8_t rx[256];
+  size_t rxLength = 0;
+  size_t rxPos = 0;
+
+  void busTime(size_t bytes);
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,104 @@
+// -----------------------------------------------------------------------------
+// Replays an IMU trace through dead_reckoning.h, the code the robot runs, and
+// prints where it thinks the robot is every 100 ms.
+//   dead_reckoning_replay samples.csv
+// samples.csv is what the sim's --imu takes and --record-imu writes:
+// time_ms,ax,ay,az,gx,gy,gz[,motors] in g and degrees/s. Traces at another
+// rate are resampled to IMU_RATE_HZ. The first second has to be standing
+// still with the motors off for the bias calibration; without a motors
+// column the motors count as off until it is done and on after, so there
+// are no zero velocity updates.
+// Build (from arduinoIDEcode):
+//   g++ -std=c++17 -O2 -Isim sim/dead_reckoning_replay.cpp -o dead_reckoning_replay
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "../imu_fifo.h"
+#include "../dead_reckoning.h"
+
+using namespace std;
+
+struct TraceSample {
+  double timeMs;
+  ImuSample sample;
+  bool motors;
+  bool motorsKnown;   // the line had a motors column
+};
+
+int16_t toRaw(double value, double perLsb) {
+  return (int16_t)max(-32768.0, min(32767.0, round(value / perLsb)));
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cout << "Usage: dead_reckoning_replay samples.csv\n";
+    return 1;
+  }
+  ifstream in(argv[1]);
+  if (!in) {
+    cout << "Can't read " << argv[1] << ".\n";
+    return 1;
+  }
+
+  vector<TraceSample> trace;
+  string line;
+  while (getline(in, line)) {
+    // header and comment lines don't start with a number
+    if (line.empty() || !(isdigit((unsigned char)line[0]) || line[0] == '.')) continue;
+    replace(line.begin(), line.end(), ',', ' ');
+    istringstream fields(line);
+    TraceSample t;
+    ImuSample& s = t.sample;
+    if (!(fields >> t.timeMs >> s.ax >> s.ay >> s.az >> s.gx >> s.gy >> s.gz)) continue;
+    int motors = 1;
+    t.motorsKnown = (bool)(fields >> motors);
+    t.motors = motors != 0;
+    trace.push_back(t);
+  }
+  if (trace.empty()) {
+    cout << "No samples in " << argv[1] << ".\n";
+    return 1;
+  }
+
+  DeadReckoning deadReckoning;
+  deadReckoning.configure(IMU_RATE_HZ, IMU_G_PER_LSB, IMU_DPS_PER_LSB);
+  deadReckoning.calibrate();
+
+  cout << "time_s,forward_mm,right_mm,forward_mm_s,right_mm_s,heading_deg,still\n";
+  size_t next = 0;
+  long ticks = 0;
+  const int printEvery = IMU_RATE_HZ / 10;
+  for (double ms = trace.front().timeMs; ms <= trace.back().timeMs; ms = trace.front().timeMs + ++ticks * 1000.0 / IMU_RATE_HZ) {
+    // the last recorded sample by now
+    while (next + 1 < trace.size() && trace[next + 1].timeMs <= ms) {
+      next++;
+    }
+    const TraceSample& t = trace[next];
+    bool motorsOff = t.motorsKnown ? !t.motors : !deadReckoning.calibrated();
+    deadReckoning.update(toRaw(t.sample.ax, IMU_G_PER_LSB), toRaw(t.sample.ay, IMU_G_PER_LSB),
+                         toRaw(t.sample.gz, IMU_DPS_PER_LSB), motorsOff);
+
+    if (ticks % printEvery == 0 && deadReckoning.calibrated()) {
+      char row[160];
+      snprintf(row, sizeof(row), "%.2f,%d,%d,%d,%d,%.1f,%d\n", ms / 1000, deadReckoning.distanceMm('y'),
+               deadReckoning.distanceMm('x'), deadReckoning.speedMmPerS('y'), deadReckoning.speedMmPerS('x'),
+               deadReckoning.headingMilliDeg() / 1000.0, deadReckoning.still() ? 1 : 0);
+      cout << row;
+    }
+  }
+
+  if (!deadReckoning.calibrated()) {
+    cout << "Never calibrated: the trace needs a second of standing still at the start.\n";
+    return 1;
+  }
+  cout << "Replayed " << ticks << " samples, " << deadReckoning.zeroVelocityUpdates() << " zero velocity updates.\n";
+  return 0;
+}
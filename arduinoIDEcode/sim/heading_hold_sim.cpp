@@ -0,0 +1,99 @@
+// Heading hold check for Robot_Tour_Code.ino (see sim.h). Drives one timed
+// full-speed forward move, the kind runStoredPlan() and runSchedule() queue,
+// with a wheel made weak, and fails unless the hold kept the heading and the
+// trim didn't cost the move its distance. Build like robot_tour_sim with this
+// file in place of robot_tour_sim.cpp, then:
+//   heading_hold_sim --wheel-gain 0.8,1,1,1 --quiet
+#include "Arduino.h"
+
+struct TimedStep;
+struct Move;
+
+void forward(float cells);
+void backward(float cells);
+void right(float cells);
+void left(float cells);
+void turnRight();
+void turnLeft();
+unsigned long distanceTimeoutMs(float cells);
+bool queueMove(char move, int pwm, float cells, unsigned long driveMs, unsigned long dwellMs);
+bool motionIdle();
+void updateMotion();
+void startMove(const Move& m, unsigned long now);
+unsigned long owedDriveMs();
+void setWheels(char move, int pwm, int trim);
+void holdHeading();
+void stopMotors();
+void sampleIMU();
+int wheelDirection(char move, int i);
+void runSchedule(const TimedStep* steps, int count);
+bool receivePlan();
+void storePlan(const uint8_t* bytes, int size);
+void runStoredPlan();
+
+// the sketch's own setup() and loop() run inside the check's
+#define setup robotTourSetup
+#define loop robotTourLoop
+#include "../Robot_Tour_Code.ino"
+#undef setup
+#undef loop
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+void simSketchWheels(SimWheel wheels[4]) {
+  for (int i = 0; i < 4; i++) {
+    wheels[i] = { motors[i].f, motors[i].b };
+  }
+}
+
+namespace {
+
+const unsigned long CHECK_DRIVE_MS = 3000;
+// degrees the robot may end up off its heading
+const double MAX_HEADING_ERROR = 3.0;
+// the four wheels' mean duty over the move may fall this far short of
+// 255 * CHECK_DRIVE_MS
+const double MIN_DUTY_SHARE = 0.98;
+
+bool moveStarted = false;
+double dutyMs = 0;              // sum over time of the mean wheel duty
+unsigned long lastMs = 0;
+
+double meanWheelDuty() {
+  double sum = 0;
+  for (int i = 0; i < 4; i++) {
+    sum += simPinDuty(motors[i].f) + simPinDuty(motors[i].b);
+  }
+  return sum / 4;
+}
+
+} // namespace
+
+void setup() {
+  robotTourSetup();
+  // no upload window, no stored plan: just the one move
+  listeningForUpload = false;
+  queueMove('w', 255, 0, CHECK_DRIVE_MS, 0);
+}
+
+void loop() {
+  unsigned long now = millis();
+  if (moveStarted) {
+    dutyMs += meanWheelDuty() * (now - lastMs);
+  }
+  lastMs = now;
+  robotTourLoop();
+  moveStarted = moveStarted || motionState == DRIVING;
+  if (!moveStarted || !motionIdle()) {
+    return;
+  }
+
+  SimPose pose = simRobotPose();
+  double share = dutyMs / (255.0 * CHECK_DRIVE_MS);
+  bool ok = fabs(pose.heading) <= MAX_HEADING_ERROR && share >= MIN_DUTY_SHARE;
+  printf("%s: heading %.1f deg, x %.3f m, y %.3f m, %.1f%% of the commanded duty\n",
+         ok ? "PASS" : "FAIL", pose.heading, pose.x, pose.y, 100 * share);
+  exit(ok ? 0 : 1);
+}
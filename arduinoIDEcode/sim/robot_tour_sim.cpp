@@ -0,0 +1,36 @@
+// Robot_Tour_Code.ino on the host (see sim.h). The Arduino IDE writes these
+// prototypes itself; keep them in step with the sketch.
+#include "Arduino.h"
+
+struct TimedStep;
+struct Move;
+
+void forward(float cells);
+void backward(float cells);
+void right(float cells);
+void left(float cells);
+void turnRight();
+void turnLeft();
+unsigned long distanceTimeoutMs(float cells);
+bool queueMove(char move, int pwm, float cells, unsigned long driveMs, unsigned long dwellMs);
+bool motionIdle();
+void updateMotion();
+void startMove(const Move& m, unsigned long now);
+unsigned long owedDriveMs();
+void setWheels(char move, int pwm, int trim);
+void holdHeading();
+void stopMotors();
+void sampleIMU();
+int wheelDirection(char move, int i);
+void runSchedule(const TimedStep* steps, int count);
+bool receivePlan();
+void storePlan(const uint8_t* bytes, int size);
+void runStoredPlan();
+
+#include "../Robot_Tour_Code.ino"
+
+void simSketchWheels(SimWheel wheels[4]) {
+  for (int i = 0; i < 4; i++) {
+    wheels[i] = { motors[i].f, motors[i].b };
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Host build of the sketches. The headers next to this one stand in for the
+// Arduino core, Wire (with the LSM6DS3's registers and FIFO behind it) and
+// EEPROM; a small drive model turns the motor pins into robot motion and IMU
+// samples, and time is virtual, so a whole run takes milliseconds. Build
+// (from arduinoIDEcode):
+//   g++ -std=c++17 -O2 -Isim sim/robot_tour_sim.cpp sim/sim_arduino.cpp sim/sim_robot.cpp sim/sim_lsm6ds3.cpp -o robot_tour_sim
+// Run:
+//   robot_tour_sim [--run-ms 30000] [--trace trace.csv] [--imu samples.csv]
+//                  [--accel-noise g] [--gyro-noise dps] [--gyro-bias dps] [--seed n]
+//                  [--wheel-gain 1,1,0.87,1]
+//                  [--serial plan.bin] [--eeprom eeprom.bin] [--record-imu samples.csv] [--quiet]
+// --wheel-gain makes wheels (motors[] order) weaker or stronger, like the
+// misaligned ones test_code.ino trims for.
+// --trace writes every motor pin change as time_ms,pin,duty (HIGH = 255).
+// --imu replays recorded samples, lines of time_ms,ax,ay,az,gx,gy,gz in g and
+// degrees/s, instead of the drive model. --serial bytes are waiting on Serial
+// from the start (a plan from the gui, say); --eeprom is loaded before and
+// saved after the run, fake_robot's fake_eeprom.bin works. --record-imu
+// writes every sample the LSM6DS3's FIFO takes, in the --imu format plus a
+// motors column (1 while any wheel is driven), for
+// dead_reckoning_replay.
+// heading_hold_sim.cpp builds the same way in place of robot_tour_sim.cpp and
+// exits 1 if a timed full-speed move loses its heading or its duty.
+// -----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+// One wheel's pins, like the sketches' Motor
+struct SimWheel {
+  int forwardPin, backwardPin;
+};
+
+// Each sketch's *_sim.cpp fills in its motors[] pins, in motors[] order
+// (upLeft, downRight, upRight, downLeft).
+void simSketchWheels(SimWheel wheels[4]);
+
+// -----------------------------------------------------------------------------
+// Virtual clock
+
+uint64_t simMicros();
+
+// Moves time, the robot and the IMU forward. Throws SimTimeUp past --run-ms,
+// which is how a sketch stuck in a loop still ends.
+void simAdvance(uint64_t us);
+
+struct SimTimeUp {};
+
+// -----------------------------------------------------------------------------
+// Drive model and IMU (sim_robot.cpp)
+
+// What the LSM6DS3 reports: g and degrees/s, y forward, x right, z up.
+struct ImuSample {
+  float ax, ay, az;
+  float gx, gy, gz;
+};
+
+struct SimPose {
+  double x, y;         // meters, y is where the robot faced at the start
+  double heading;      // degrees, counterclockwise
+};
+
+struct SimRobotOptions {
+  double accelNoise = 0;   // g, standard deviation
+  double gyroNoise = 0;    // degrees/s
+  double gyroBias = 0;     // degrees/s, added to gz
+  unsigned seed = 1;
+  double wheelGain[4] = { 1, 1, 1, 1 };
+};
+
+void simRobotStart(const SimWheel wheels[4], const SimRobotOptions& options);
+// false if the file can't be read
+bool simLoadImuReplay(const char* path);
+// runs the drive model from the current pin duties
+void simRobotStep(double seconds);
+// a fresh reading right now, new noise every call
+ImuSample simImuReading();
+SimPose simRobotPose();
+
+// any wheel driven
+bool simMotorsOn();
+
+// current duty of a pin, 0-255
+int simPinDuty(int pin);
+// to --record-imu, if given
+void simRecordImu(const ImuSample& sample);
+
+// LSM6DS3 registers behind Wire (sim_lsm6ds3.cpp)
+void simLsm6ds3Start();
+// fills the FIFO up to now
+void simLsm6ds3Step();
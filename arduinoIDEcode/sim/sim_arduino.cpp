@@ -0,0 +1,346 @@
+// -----------------------------------------------------------------------------
+// The Arduino core and EEPROM stand-ins, the virtual clock and main() for the
+// host build of a sketch. See sim.h.
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+
+using namespace std;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+namespace {
+
+// a millis()/micros() call and one pass of loop() aren't free on the robot
+// either; this also keeps sketches that poll the clock moving
+const uint64_t CLOCK_CALL_US = 5;
+const uint64_t LOOP_PASS_US = 10;
+// the drive model runs in steps of this much
+const uint64_t MODEL_STEP_US = 1000;
+
+const int PIN_COUNT = 64;
+
+uint64_t nowUs = 0;
+uint64_t modelUs = 0;
+uint64_t endUs = 30000000;
+
+int pinDuty[PIN_COUNT];
+// Like the SAMD core: analogWrite hands a pin to a timer and digitalWrite
+// only sets the port latch, which the pin ignores until pinMode takes it back.
+bool pinOnTimer[PIN_COUNT];
+int pinLatch[PIN_COUNT];
+ofstream trace;
+ofstream imuRecord;
+long pinChanges = 0;
+
+vector<uint8_t> serialIn;
+size_t serialInPos = 0;
+string serialLine;
+bool quiet = false;
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Clock
+uint64_t simMicros() {
+  return nowUs;
+}
+
+void simAdvance(uint64_t us) {
+  uint64_t target = nowUs + us;
+  while (modelUs + MODEL_STEP_US <= target) {
+    simRobotStep(MODEL_STEP_US / 1e6);
+    modelUs += MODEL_STEP_US;
+    nowUs = modelUs;
+    simLsm6ds3Step();
+  }
+  nowUs = target;
+  if (nowUs > endUs) {
+    throw SimTimeUp();
+  }
+}
+
+unsigned long millis() {
+  simAdvance(CLOCK_CALL_US);
+  return (unsigned long)(nowUs / 1000);
+}
+
+unsigned long micros() {
+  simAdvance(CLOCK_CALL_US);
+  return (unsigned long)nowUs;
+}
+
+void delay(unsigned long ms) {
+  simAdvance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simAdvance(us);
+}
+
+// -----------------------------------------------------------------------------
+// Pins
+int simPinDuty(int pin) {
+  return pin >= 0 && pin < PIN_COUNT ? pinDuty[pin] : 0;
+}
+
+namespace {
+
+void setPin(int pin, int duty) {
+  if (pin < 0 || pin >= PIN_COUNT) {
+    cout << "Pin " << pin << " doesn't exist.\n";
+    return;
+  }
+  duty = max(0, min(255, duty));
+  if (pinDuty[pin] == duty) return;
+  pinDuty[pin] = duty;
+  pinChanges++;
+  if (trace.is_open()) {
+    char line[64];
+    snprintf(line, sizeof(line), "%.3f,%d,%d\n", nowUs / 1000.0, pin, duty);
+    trace << line;
+  }
+}
+
+} // namespace
+
+void simRecordImu(const ImuSample& s) {
+  if (!imuRecord.is_open()) return;
+  char line[160];
+  snprintf(line, sizeof(line), "%.3f,%.5f,%.5f,%.5f,%.3f,%.3f,%.3f,%d\n", nowUs / 1000.0,
+           s.ax, s.ay, s.az, s.gx, s.gy, s.gz, simMotorsOn() ? 1 : 0);
+  imuRecord << line;
+}
+
+void pinMode(int pin, int mode) {
+  (void)mode;
+  if (pin < 0 || pin >= PIN_COUNT || !pinOnTimer[pin]) return;
+  pinOnTimer[pin] = false;
+  setPin(pin, pinLatch[pin]);
+}
+
+void digitalWrite(int pin, int value) {
+  if (pin >= 0 && pin < PIN_COUNT) {
+    pinLatch[pin] = value == LOW ? 0 : 255;
+    if (pinOnTimer[pin]) return;
+  }
+  setPin(pin, value == LOW ? 0 : 255);
+}
+
+int digitalRead(int pin) {
+  return simPinDuty(pin) > 0 ? HIGH : LOW;
+}
+
+void analogWrite(int pin, int value) {
+  if (pin >= 0 && pin < PIN_COUNT) {
+    pinOnTimer[pin] = true;
+  }
+  setPin(pin, value);
+}
+
+// -----------------------------------------------------------------------------
+// Serial
+int HardwareSerial::available() {
+  return (int)(serialIn.size() - serialInPos);
+}
+
+int HardwareSerial::read() {
+  return serialInPos < serialIn.size() ? serialIn[serialInPos++] : -1;
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  if (b == '\r') return 1;
+  if (b != '\n') {
+    serialLine += (char)b;
+    return 1;
+  }
+  if (!quiet) {
+    char stamp[32];
+    snprintf(stamp, sizeof(stamp), "[%9.3f s] ", nowUs / 1e6);
+    cout << stamp << serialLine << "\n";
+  }
+  serialLine.clear();
+  return 1;
+}
+
+size_t HardwareSerial::print(const char* s) {
+  size_t n = 0;
+  while (*s) n += write((uint8_t)*s++);
+  return n;
+}
+
+size_t HardwareSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(unsigned char n) {
+  return print((unsigned long)n);
+}
+
+size_t HardwareSerial::print(int n) {
+  return print((long)n);
+}
+
+size_t HardwareSerial::print(unsigned int n) {
+  return print((unsigned long)n);
+}
+
+size_t HardwareSerial::print(long n) {
+  return print(to_string(n).c_str());
+}
+
+size_t HardwareSerial::print(unsigned long n) {
+  return print(to_string(n).c_str());
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+  char text[64];
+  snprintf(text, sizeof(text), "%.*f", digits, n);
+  return print(text);
+}
+
+size_t HardwareSerial::println() {
+  return write('\r') + write('\n');
+}
+
+// -----------------------------------------------------------------------------
+// EEPROM
+EEPROMClass::EEPROMClass() {
+  memset(bytes, 0xFF, sizeof(bytes));
+}
+
+uint8_t EEPROMClass::read(int address) const {
+  return address >= 0 && address < SIM_EEPROM_SIZE ? bytes[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if (address < 0 || address >= SIM_EEPROM_SIZE) return;
+  bytes[address] = value;
+  changed = true;
+}
+
+// -----------------------------------------------------------------------------
+namespace {
+
+bool readFile(const string& path, vector<uint8_t>& bytes) {
+  ifstream in(path, ios::binary);
+  if (!in) return false;
+  bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  SimRobotOptions robotOptions;
+  string tracePath, imuPath, eepromPath, recordPath;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--run-ms" && hasValue) {
+      endUs = (uint64_t)atof(argv[++i]) * 1000;
+    } else if (arg == "--trace" && hasValue) {
+      tracePath = argv[++i];
+    } else if (arg == "--imu" && hasValue) {
+      imuPath = argv[++i];
+    } else if (arg == "--accel-noise" && hasValue) {
+      robotOptions.accelNoise = atof(argv[++i]);
+    } else if (arg == "--gyro-noise" && hasValue) {
+      robotOptions.gyroNoise = atof(argv[++i]);
+    } else if (arg == "--gyro-bias" && hasValue) {
+      robotOptions.gyroBias = atof(argv[++i]);
+    } else if (arg == "--wheel-gain" && hasValue) {
+      double* gain = robotOptions.wheelGain;
+      if (sscanf(argv[++i], "%lf,%lf,%lf,%lf", &gain[0], &gain[1], &gain[2], &gain[3]) != 4) {
+        cout << "--wheel-gain takes four numbers, like 1,1,0.87,1.\n";
+        return 1;
+      }
+    } else if (arg == "--seed" && hasValue) {
+      robotOptions.seed = (unsigned)atoi(argv[++i]);
+    } else if (arg == "--serial" && hasValue) {
+      if (!readFile(argv[++i], serialIn)) {
+        cout << "Can't read " << argv[i] << ".\n";
+        return 1;
+      }
+    } else if (arg == "--eeprom" && hasValue) {
+      eepromPath = argv[++i];
+    } else if (arg == "--record-imu" && hasValue) {
+      recordPath = argv[++i];
+    } else if (arg == "--quiet") {
+      quiet = true;
+    } else {
+      cout << "Unknown option " << arg << ", see sim.h.\n";
+      return 1;
+    }
+  }
+
+  if (!tracePath.empty()) {
+    trace.open(tracePath);
+    if (!trace) {
+      cout << "Can't write " << tracePath << ".\n";
+      return 1;
+    }
+    trace << "time_ms,pin,duty\n";
+  }
+  if (!recordPath.empty()) {
+    imuRecord.open(recordPath);
+    if (!imuRecord) {
+      cout << "Can't write " << recordPath << ".\n";
+      return 1;
+    }
+    imuRecord << "time_ms,ax,ay,az,gx,gy,gz,motors\n";
+  }
+  if (!eepromPath.empty()) {
+    // a missing file is a blank EEPROM
+    vector<uint8_t> stored;
+    if (readFile(eepromPath, stored)) {
+      memcpy(EEPROM.bytes, stored.data(), min(stored.size(), sizeof(EEPROM.bytes)));
+    }
+  }
+
+  SimWheel wheels[4];
+  simSketchWheels(wheels);
+  simRobotStart(wheels, robotOptions);
+  simLsm6ds3Start();
+  if (!imuPath.empty() && !simLoadImuReplay(imuPath.c_str())) {
+    cout << "Can't read IMU samples from " << imuPath << ".\n";
+    return 1;
+  }
+
+  auto started = chrono::steady_clock::now();
+  try {
+    setup();
+    while (true) {
+      loop();
+      simAdvance(LOOP_PASS_US);
+    }
+  } catch (const SimTimeUp&) {
+  }
+  double realSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+  if (!serialLine.empty()) {
+    Serial.println();
+  }
+  if (!eepromPath.empty() && EEPROM.changed) {
+    ofstream out(eepromPath, ios::binary);
+    out.write((const char*)EEPROM.bytes, sizeof(EEPROM.bytes));
+  }
+
+  SimPose pose = simRobotPose();
+  char summary[256];
+  snprintf(summary, sizeof(summary),
+           "Ran %.3f s of robot time in %.3f s, %ld pin changes. Ended at x %.3f m, y %.3f m, heading %.1f deg.\n",
+           endUs / 1e6, realSeconds, pinChanges, pose.x, pose.y, pose.heading);
+  cout << summary;
+  return 0;
+}
@@ -0,0 +1,220 @@
+// -----------------------------------------------------------------------------
+// Wire with an LSM6DS3 behind it: the registers imu_fifo.h touches and the
+// FIFO, filled from the drive model at the rate FIFO_CTRL5 asks for. Only
+// what the sketches use; everything else reads back as written. See sim.h.
+// -----------------------------------------------------------------------------
+
+#include <deque>
+#include <algorithm>
+#include <cmath>
+
+#include "Arduino.h"
+#include "Wire.h"
+
+using namespace std;
+
+TwoWire Wire;
+
+namespace {
+
+const uint8_t DEVICE_ADDRESS = 0x6A;
+
+const uint8_t FIFO_CTRL1 = 0x06;
+const uint8_t FIFO_CTRL2 = 0x07;
+const uint8_t FIFO_CTRL3 = 0x08;
+const uint8_t FIFO_CTRL5 = 0x0A;
+const uint8_t WHO_AM_I = 0x0F;
+const uint8_t CTRL1_XL = 0x10;
+const uint8_t CTRL2_G = 0x11;
+const uint8_t CTRL3_C = 0x12;
+const uint8_t FIFO_STATUS1 = 0x3A;
+const uint8_t FIFO_STATUS2 = 0x3B;
+const uint8_t FIFO_STATUS3 = 0x3C;
+const uint8_t FIFO_STATUS4 = 0x3D;
+const uint8_t FIFO_DATA_OUT_L = 0x3E;
+const uint8_t FIFO_DATA_OUT_H = 0x3F;
+
+const size_t FIFO_WORDS = 4096;   // 8 kB
+// FIFO_CTRL5 ODR_FIFO codes 1-10
+const double FIFO_RATES[11] = { 0, 12.5, 26, 52, 104, 208, 416, 833, 1660, 3330, 6660 };
+// per LSB for each FS_XL / FS_G setting
+const double G_PER_LSB[4] = { 0.061e-3, 0.488e-3, 0.122e-3, 0.244e-3 };
+const double DPS_PER_LSB[4] = { 8.75e-3, 17.5e-3, 35e-3, 70e-3 };
+
+uint8_t regs[0x80];
+uint8_t pointer = 0;
+bool pointerSet = false;
+
+deque<uint16_t> fifo;
+int patternPos = 0;   // next word's place in its sample set
+bool overrun = false;
+double nextSampleUs = 0;
+
+} // namespace
+
+void simLsm6ds3Start() {
+  regs[WHO_AM_I] = 0x69;
+  regs[CTRL3_C] = 0x04;   // auto-increment is on after power-up
+}
+
+namespace {
+
+int fifoMode() { return regs[FIFO_CTRL5] & 0x07; }
+
+// words per sample set: gyro and/or accelerometer, three axes each
+int setWords() {
+  return (((regs[FIFO_CTRL3] >> 3) & 0x07) ? 3 : 0) + ((regs[FIFO_CTRL3] & 0x07) ? 3 : 0);
+}
+
+int16_t toRaw(double value, double perLsb) {
+  return (int16_t)max(-32768.0, min(32767.0, round(value / perLsb)));
+}
+
+void pushSample() {
+  int words = setWords();
+  if (words == 0) return;
+  while (fifo.size() + words > FIFO_WORDS) {
+    if (fifoMode() != 0x06) return;   // FIFO mode stops when full
+    // continuous: the oldest set goes, or what's left of a half-read one
+    int drop = min((int)fifo.size(), words - patternPos);
+    fifo.erase(fifo.begin(), fifo.begin() + drop);
+    patternPos = 0;
+    overrun = true;
+  }
+
+  ImuSample s = simImuReading();
+  simRecordImu(s);
+  if ((regs[FIFO_CTRL3] >> 3) & 0x07) {
+    double dps = DPS_PER_LSB[(regs[CTRL2_G] >> 2) & 0x03];
+    fifo.push_back((uint16_t)toRaw(s.gx, dps));
+    fifo.push_back((uint16_t)toRaw(s.gy, dps));
+    fifo.push_back((uint16_t)toRaw(s.gz, dps));
+  }
+  if (regs[FIFO_CTRL3] & 0x07) {
+    double g = G_PER_LSB[(regs[CTRL1_XL] >> 2) & 0x03];
+    fifo.push_back((uint16_t)toRaw(s.ax, g));
+    fifo.push_back((uint16_t)toRaw(s.ay, g));
+    fifo.push_back((uint16_t)toRaw(s.az, g));
+  }
+}
+
+} // namespace
+
+void simLsm6ds3Step() {
+  int rateCode = (regs[FIFO_CTRL5] >> 3) & 0x0F;
+  if (fifoMode() == 0 || rateCode == 0 || rateCode > 10) return;
+  double periodUs = 1e6 / FIFO_RATES[rateCode];
+  while (nextSampleUs <= simMicros()) {
+    pushSample();
+    nextSampleUs += periodUs;
+  }
+}
+
+namespace {
+
+void writeRegister(uint8_t reg, uint8_t value) {
+  regs[reg] = value;
+  if (reg == FIFO_CTRL5) {
+    if (fifoMode() == 0) {
+      fifo.clear();
+      patternPos = 0;
+      overrun = false;
+    }
+    int rateCode = (value >> 3) & 0x0F;
+    if (rateCode > 0 && rateCode <= 10) {
+      nextSampleUs = simMicros() + 1e6 / FIFO_RATES[rateCode];
+    }
+  }
+}
+
+uint8_t readRegister(uint8_t reg) {
+  int words = (int)fifo.size();
+  int threshold = regs[FIFO_CTRL1] | ((regs[FIFO_CTRL2] & 0x0F) << 8);
+  switch (reg) {
+    case FIFO_STATUS1:
+      return words & 0xFF;
+    case FIFO_STATUS2:
+      return ((words >> 8) & 0x0F) | (words == 0 ? 0x10 : 0) | (words == (int)FIFO_WORDS ? 0x20 : 0)
+             | (overrun ? 0x40 : 0) | (threshold > 0 && words >= threshold ? 0x80 : 0);
+    case FIFO_STATUS3:
+      return patternPos & 0xFF;
+    case FIFO_STATUS4:
+      return (patternPos >> 8) & 0x03;
+    case FIFO_DATA_OUT_L:
+      return fifo.empty() ? 0 : fifo.front() & 0xFF;
+    case FIFO_DATA_OUT_H: {
+      if (fifo.empty()) return 0;
+      uint8_t high = fifo.front() >> 8;
+      fifo.pop_front();
+      int length = setWords();
+      patternPos = length ? (patternPos + 1) % length : 0;
+      return high;
+    }
+  }
+  return regs[reg];
+}
+
+void nextRegister() {
+  if (pointer == FIFO_DATA_OUT_H) {
+    pointer = FIFO_DATA_OUT_L;   // rolls back so a burst keeps draining the FIFO
+  } else if (regs[CTRL3_C] & 0x04) {
+    pointer = (pointer + 1) & 0x7F;
+  }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// TwoWire
+void TwoWire::busTime(size_t bytes) {
+  // 9 clocks a byte, plus the address byte and start/stop
+  simAdvance((uint64_t)((bytes + 2) * 9 * 1e6 / clockHz));
+}
+
+void TwoWire::beginTransmission(uint8_t to) {
+  address = to;
+  txBytes = 0;
+  pointerSet = false;
+}
+
+size_t TwoWire::write(uint8_t b) {
+  txBytes++;
+  if (address != DEVICE_ADDRESS) return 1;
+  if (!pointerSet) {
+    pointer = b & 0x7F;
+    pointerSet = true;
+  } else {
+    writeRegister(pointer, b);
+    nextRegister();
+  }
+  return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool stop) {
+  (void)stop;
+  busTime(txBytes);
+  return address == DEVICE_ADDRESS ? 0 : 2;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t from, size_t count, bool stop) {
+  (void)stop;
+  rxLength = 0;
+  rxPos = 0;
+  if (from != DEVICE_ADDRESS) return 0;
+  count = min(count, sizeof(rx));
+  for (size_t i = 0; i < count; i++) {
+    rx[i] = readRegister(pointer);
+    nextRegister();
+  }
+  rxLength = count;
+  busTime(count);
+  return (uint8_t)count;
+}
+
+int TwoWire::available() {
+  return (int)(rxLength - rxPos);
+}
+
+int TwoWire::read() {
+  return rxPos < rxLength ? rx[rxPos++] : -1;
+}
@@ -0,0 +1,128 @@
+// -----------------------------------------------------------------------------
+// Drive model behind the simulated IMU. The four mecanum wheels' pin duties
+// give a forward, sideways and turning speed the robot eases toward; the
+// accelerometer sees the change in speed, the gyro the turn rate. Rough
+// numbers, good enough to see whether the sketches' moves would stop where
+// they should. See sim.h.
+// -----------------------------------------------------------------------------
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include "sim.h"
+
+using namespace std;
+
+namespace {
+
+const double MAX_SPEED = 0.5;          // m/s, all wheels forward at full duty
+const double STRAFE_EFFICIENCY = 0.8;  // mecanum rollers lose some going sideways
+const double MAX_TURN_RATE = 90;       // degrees/s spinning in place at full duty
+const double TIME_CONSTANT = 0.15;     // s, motors and mass getting up to speed
+const double GRAVITY = 9.81;
+const double PI = 3.14159265358979;
+
+SimWheel wheelPins[4];
+SimRobotOptions robotOptions;
+mt19937 noiseRng;
+
+// body frame: forward, right (m/s), turn counterclockwise (degrees/s)
+double vForward = 0, vRight = 0, turnRate = 0;
+double aForward = 0, aRight = 0;
+SimPose pose = { 0, 0, 0 };
+
+// recorded samples and when they were taken (ms)
+vector<double> replayTimes;
+vector<ImuSample> replaySamples;
+
+} // namespace
+
+void simRobotStart(const SimWheel wheels[4], const SimRobotOptions& options) {
+  copy(wheels, wheels + 4, wheelPins);
+  robotOptions = options;
+  noiseRng.seed(options.seed);
+}
+
+bool simLoadImuReplay(const char* path) {
+  ifstream in(path);
+  if (!in) return false;
+  string line;
+  while (getline(in, line)) {
+    // header and comment lines don't start with a number
+    if (line.empty() || !(isdigit((unsigned char)line[0]) || line[0] == '.')) continue;
+    replace(line.begin(), line.end(), ',', ' ');
+    istringstream fields(line);
+    double t;
+    ImuSample s;
+    if (fields >> t >> s.ax >> s.ay >> s.az >> s.gx >> s.gy >> s.gz) {
+      replayTimes.push_back(t);
+      replaySamples.push_back(s);
+    }
+  }
+  return !replayTimes.empty();
+}
+
+void simRobotStep(double seconds) {
+  double w[4];
+  for (int i = 0; i < 4; i++) {
+    w[i] = (simPinDuty(wheelPins[i].forwardPin) - simPinDuty(wheelPins[i].backwardPin)) / 255.0
+           * robotOptions.wheelGain[i];
+  }
+  // motors[] is upLeft, downRight, upRight, downLeft
+  double forwardTarget = (w[0] + w[1] + w[2] + w[3]) / 4 * MAX_SPEED;
+  double rightTarget = (w[0] + w[1] - w[2] - w[3]) / 4 * MAX_SPEED * STRAFE_EFFICIENCY;
+  double turnTarget = -(w[0] + w[3] - w[1] - w[2]) / 4 * MAX_TURN_RATE;
+
+  double k = 1 - exp(-seconds / TIME_CONSTANT);
+  double forward = vForward + (forwardTarget - vForward) * k;
+  double right = vRight + (rightTarget - vRight) * k;
+  aForward = (forward - vForward) / seconds;
+  aRight = (right - vRight) / seconds;
+  vForward = forward;
+  vRight = right;
+  turnRate += (turnTarget - turnRate) * k;
+
+  double h = pose.heading * PI / 180;
+  pose.x += (-sin(h) * vForward + cos(h) * vRight) * seconds;
+  pose.y += (cos(h) * vForward + sin(h) * vRight) * seconds;
+  pose.heading += turnRate * seconds;
+}
+
+ImuSample simImuReading() {
+  if (!replayTimes.empty()) {
+    // the last sample taken by now, the first one before that
+    double nowMs = simMicros() / 1000.0;
+    size_t i = upper_bound(replayTimes.begin(), replayTimes.end(), nowMs) - replayTimes.begin();
+    return replaySamples[i > 0 ? i - 1 : 0];
+  }
+
+  // turning while moving pulls sideways too
+  double w = turnRate * PI / 180;
+  normal_distribution<double> noise(0, 1);
+  ImuSample s;
+  s.ax = (float)((aRight - w * vForward) / GRAVITY + noise(noiseRng) * robotOptions.accelNoise);
+  s.ay = (float)((aForward + w * vRight) / GRAVITY + noise(noiseRng) * robotOptions.accelNoise);
+  s.az = (float)(1 + noise(noiseRng) * robotOptions.accelNoise);
+  s.gx = (float)(noise(noiseRng) * robotOptions.gyroNoise);
+  s.gy = (float)(noise(noiseRng) * robotOptions.gyroNoise);
+  s.gz = (float)(turnRate + robotOptions.gyroBias + noise(noiseRng) * robotOptions.gyroNoise);
+  return s;
+}
+
+bool simMotorsOn() {
+  for (int i = 0; i < 4; i++) {
+    if (simPinDuty(wheelPins[i].forwardPin) > 0 || simPinDuty(wheelPins[i].backwardPin) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SimPose simRobotPose() {
+  return pose;
+}
@@ -0,0 +1,23 @@
+// test_code.ino on the host (see sim.h). The Arduino IDE writes these
+// prototypes itself; keep them in step with the sketch.
+#include "Arduino.h"
+
+void w();
+void w(float cells);
+void s();
+void s(float cells);
+void d();
+void d(float cells);
+void a();
+void a(float cells);
+void q();
+void e();
+void stopMotors(int delayAmount);
+
+#include "../test_code.ino"
+
+void simSketchWheels(SimWheel wheels[4]) {
+  for (int i = 0; i < 4; i++) {
+    wheels[i] = { motors[i].f, motors[i].b };
+  }
+}
@@ -28,6 +28,7 @@ int fwd = 1000;
 int bwd = 1000;
 int rt = 1000;
 int lt = 1000;
+int trn = 1000; // 90 degree turn in place
 int def = 1000;
 
 Motor upLeft(A4, A5);
@@ -79,6 +80,11 @@ void loop() {
 }
 
 void w() {
+  w(1);
+}
+
+// w/s/d/a(cells) drive a whole segment without stopping in between
+void w(float cells) {
   for(int i = 0; i < 4; i++){
     if(i == 2){
       digitalWrite(motors[i].f, HIGH);
@@ -90,18 +96,26 @@ void w() {
   } 
   
   
-  stopMotors(fwd);
+  stopMotors(fwd * cells);
 }
 
 void s() {
+  s(1);
+}
+
+void s(float cells) {
   for(int i = 0; i < 4; i++){
     digitalWrite(motors[i].f, LOW);
     digitalWrite(motors[i].b, HIGH);
   }
-  stopMotors(bwd);
+  stopMotors(bwd * cells);
 }
 
 void d() {
+  d(1);
+}
+
+void d(float cells) {
   for(int i = 0; i < 2; i++){
     digitalWrite(motors[i].f, HIGH);
     digitalWrite(motors[i].b, LOW);
@@ -110,10 +124,14 @@ void d() {
     digitalWrite(motors[i].f, LOW);
     digitalWrite(motors[i].b, HIGH);
   }
-  stopMotors(rt);
+  stopMotors(rt * cells);
 }
 
 void a() {
+  a(1);
+}
+
+void a(float cells) {
   for(int i = 0; i < 2; i++){
     digitalWrite(motors[i].f, LOW);
     digitalWrite(motors[i].b, HIGH);
@@ -122,7 +140,35 @@ void a() {
     digitalWrite(motors[i].f, HIGH);
     digitalWrite(motors[i].b, LOW);
   }
-  stopMotors(lt);
+  stopMotors(lt * cells);
+}
+
+// turn left in place (turnLeft() in the gui output)
+void q() {
+  // upLeft, downLeft backward, downRight, upRight forward
+  digitalWrite(motors[0].f, LOW);
+  digitalWrite(motors[0].b, HIGH);
+  digitalWrite(motors[3].f, LOW);
+  digitalWrite(motors[3].b, HIGH);
+  digitalWrite(motors[1].f, HIGH);
+  digitalWrite(motors[1].b, LOW);
+  digitalWrite(motors[2].f, HIGH);
+  digitalWrite(motors[2].b, LOW);
+  stopMotors(trn);
+}
+
+// turn right in place (turnRight() in the gui output)
+void e() {
+  // upLeft, downLeft forward, downRight, upRight backward
+  digitalWrite(motors[0].f, HIGH);
+  digitalWrite(motors[0].b, LOW);
+  digitalWrite(motors[3].f, HIGH);
+  digitalWrite(motors[3].b, LOW);
+  digitalWrite(motors[1].f, LOW);
+  digitalWrite(motors[1].b, HIGH);
+  digitalWrite(motors[2].f, LOW);
+  digitalWrite(motors[2].b, HIGH);
+  stopMotors(trn);
 }
 
 void stopMotors(int delayAmount) {
@@ -0,0 +1,396 @@
+// -----------------------------------------------------------------------------
+// Planner benchmark.
+//   bench.exe [--baseline FILE] [--write-baseline FILE] [--threshold 0.25]
+// Runs shortestPathBetween, findBestPermutation and pathToCommands on seeded
+// random tracks and reports median / p99 latency (fastest of a few runs per
+// track), heap allocations, search nodes expanded and the predicted time of
+// the tour found per track, plus how long one wall edit takes to reach a new
+// route through IncrementalPlanner. With
+// --baseline it exits with 1 if any number got worse than
+// baseline * (1 + threshold); p99s get twice the threshold. A replan after a
+// cancelled plan that disagrees with a fresh one, an order whose time isn't
+// the route's, a drawn route the commands don't drive, or a route off a
+// start that sits on a wall, always fails the run.
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+
+#include "planner.h"
+#include "track_gen.h"
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+// Count every heap allocation in the process
+atomic<long long> allocationCount{0};
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// wrong answers, not timings; any of these fails the run
+int failures = 0;
+
+// -----------------------------------------------------------------------------
+struct Scenario {
+    const char* name;
+    TrackGenParams params;
+    int numTracks;
+    int searchTimeBudgetMs = 0;    // 0 = PlannerOptions' default
+};
+
+// Roughly: competition fields, then bigger practice fields that hit each
+// solver, with the checkpoint counts either side of each switch-over.
+// Branch-and-bound nearly always runs out its budget on these, so it gets a
+// short one; its times are the budget, tour_median_s says what it found.
+const Scenario SCENARIOS[] = {
+    { "4x4_4cp_permutations",  { 4, 0.20, 4, MID_BOTTOM, CENTER, 1 },               200 },
+    { "5x5_7cp_permutations",  { 5, 0.25, 7, CORNER_BOTTOM_LEFT, MID_TOP, 1 },      100 },
+    { "6x6_8cp_held_karp",     { 6, 0.25, 8, MID_BOTTOM, CORNER_TOP_RIGHT, 1 },     50 },
+    { "6x6_10cp_held_karp",    { 6, 0.25, 10, MID_BOTTOM, CORNER_TOP_RIGHT, 1 },    50 },
+    { "8x8_14cp_held_karp",    { 8, 0.30, 14, MID_LEFT, CENTER, 1 },                20 },
+    { "8x8_20cp_held_karp",    { 8, 0.30, 20, MID_LEFT, CENTER, 1 },                1 },
+    { "8x8_21cp_branch_bound", { 8, 0.30, 21, MID_LEFT, CENTER, 1 },                3,    200 },
+    { "8x8_29cp_branch_bound", { 8, 0.30, 29, MID_LEFT, CENTER, 1 },                3,    200 },
+    { "8x8_30cp_local",        { 8, 0.30, 30, MID_LEFT, CENTER, 1 },                10 },
+    { "10x10_35cp_local",      { 10, 0.30, 35, MID_BOTTOM, CENTER, 1 },             5 },
+};
+
+// each track is planned this many times and the fastest run counts, so one
+// preempted run doesn't show up as a p99 regression
+const int REPEATS = 5;
+
+// timings under this many ms are noise, don't call them regressions
+const double TIME_SLACK_MS = 0.05;
+
+// a p99 is one or two tracks, let it move further than the medians
+const double P99_THRESHOLD_SCALE = 2.0;
+
+// Drive the commands on the half-cell lattice and list the cell centers they
+// pass: that has to be the path plan() hands out to draw.
+bool pathMatchesCommands(const Track& track, const PlanResult& result) {
+    const RobotState& start = track.robotStartState;
+    int hx = 2 * start.gridX + 1 + POSITION_DX[start.positionType];
+    int hy = 2 * start.gridY + 1 + POSITION_DY[start.positionType];
+    int heading = start.orientation;
+    vector<pair<int,int>> driven;
+    for (const MotionCommand& c : result.commands) {
+        if (isTurn(c.prim)) {
+            heading = (heading + (c.prim == PRIM_TURN_RIGHT ? 1 : 3)) % 4;
+            continue;
+        }
+        int dir = moveDir(heading, c.prim);
+        for (int i = 0; i < c.distance / HALF_CELL; i++) {
+            hx += DIR_DX[dir];
+            hy += DIR_DY[dir];
+            pair<int,int> cell = { hx / 2, hy / 2 };
+            if ((hx & 1) && (hy & 1) && (driven.empty() || driven.back() != cell)) {
+                driven.push_back(cell);
+            }
+        }
+    }
+    return driven == result.path;
+}
+
+double percentile(vector<double> v, double p) {
+    if (v.empty()) return 0;
+    sort(v.begin(), v.end());
+    size_t idx = (size_t)min<double>(v.size() - 1, p * (v.size() - 1) + 0.5);
+    return v[idx];
+}
+
+double msSince(chrono::steady_clock::time_point t) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+// -----------------------------------------------------------------------------
+// Results are "scenario metric" -> value
+map<string, double> runScenario(Planner& planner, const Scenario& sc) {
+    vector<double> pathMs, permMs, cmdMs, totalMs, editMs, allocs, nodes, tourSec;
+
+    for (int i = -1; i < sc.numTracks; i++) {
+        TrackGenParams params = sc.params;
+        params.seed = sc.params.seed + max(i, 0);
+        Track track = generateTrack(params);
+        pair<int,int> startCell = { track.robotStartState.gridX, track.robotStartState.gridY };
+
+        double a = 1e30, b = 1e30, c = 1e30;
+        long long allocsBefore = 0, nodesBefore = 0;
+        vector<pair<int,int>> path;
+        vector<MotionCommand> commands;
+        double tour = 0;
+        for (int rep = 0; rep < REPEATS; rep++) {
+            allocsBefore = allocationCount;
+            nodesBefore = planner.totalNodesExpanded();
+
+            auto t = chrono::steady_clock::now();
+            path = planner.shortestPathBetween(track, startCell, track.endCheckpoint);
+            a = min(a, msSince(t));
+
+            t = chrono::steady_clock::now();
+            PermResult best = planner.findBestPermutation(track);
+            b = min(b, msSince(t));
+            tour = best.dist;
+
+            t = chrono::steady_clock::now();
+            commands = planner.pathToCommands(track, best.finalPath, track.robotStartState.orientation);
+            c = min(c, msSince(t));
+        }
+
+        long long trackAllocs = allocationCount - allocsBefore;
+        long long trackNodes = planner.totalNodesExpanded() - nodesBefore;
+        if (path.empty() || commands.empty()) {
+            cout << sc.name << ": track " << i << " has no route\n";
+        }
+
+        // edit -> route: toggle one wall next to the start and replan incrementally
+        IncrementalPlanner incremental(planner);
+        incremental.setTrack(track);
+        incremental.plan();
+        Track edited = track;
+        int wx = min(track.robotStartState.gridX, track.gSize - 2);
+        edited.toggleVerticalWall(wx, track.robotStartState.gridY);
+        double e = 1e30;
+        for (int rep = 0; rep < REPEATS; rep++) {
+            auto t = chrono::steady_clock::now();
+            incremental.setTrack(edited);
+            incremental.plan();
+            e = min(e, msSince(t));
+            // and back, so the next repeat times the same edit
+            incremental.setTrack(track);
+            incremental.plan();
+        }
+
+        // cancel -> edit: a plan cancelled mid-search, then the wall back,
+        // has to come out the same as planning from scratch
+        for (int pass = 0; pass < 2; pass++) {
+            const Track& before = pass == 0 ? track : edited;
+            const Track& after = pass == 0 ? edited : track;
+            IncrementalPlanner cancelled(planner);
+            cancelled.setTrack(before);
+            PlanProgress progress;
+            progress.cancel = true;
+            cancelled.plan(&progress);
+            cancelled.setTrack(after);
+            PlanResult got = cancelled.plan();
+            PlanResult want = planner.plan(after);
+            if (got.found != want.found || got.predictedSeconds != want.predictedSeconds) {
+                cout << sc.name << ": track " << i << " replans to " << got.predictedSeconds
+                     << " s after a cancel, " << want.predictedSeconds << " s from scratch\n";
+                failures++;
+            }
+            if (want.found && !pathMatchesCommands(after, want)) {
+                cout << sc.name << ": track " << i << " draws a different route than its commands drive\n";
+                failures++;
+            }
+        }
+
+        // first round only warms up the workspace pool
+        if (i < 0) continue;
+
+        pathMs.push_back(a);
+        permMs.push_back(b);
+        cmdMs.push_back(c);
+        totalMs.push_back(a + b + c);
+        editMs.push_back(e);
+        // counts are from the last repeat, the same every time once warmed up
+        allocs.push_back((double)trackAllocs);
+        nodes.push_back((double)trackNodes);
+        tourSec.push_back(tour);
+    }
+
+    map<string, double> r;
+    string n = sc.name;
+    r[n + " path_median_ms"] = percentile(pathMs, 0.5);
+    r[n + " path_p99_ms"] = percentile(pathMs, 0.99);
+    r[n + " permutation_median_ms"] = percentile(permMs, 0.5);
+    r[n + " permutation_p99_ms"] = percentile(permMs, 0.99);
+    r[n + " commands_median_ms"] = percentile(cmdMs, 0.5);
+    r[n + " commands_p99_ms"] = percentile(cmdMs, 0.99);
+    r[n + " total_median_ms"] = percentile(totalMs, 0.5);
+    r[n + " total_p99_ms"] = percentile(totalMs, 0.99);
+    r[n + " edit_median_ms"] = percentile(editMs, 0.5);
+    r[n + " edit_p99_ms"] = percentile(editMs, 0.99);
+    r[n + " allocations_median"] = percentile(allocs, 0.5);
+    r[n + " nodes_median"] = percentile(nodes, 0.5);
+    r[n + " tour_median_s"] = percentile(tourSec, 0.5);
+    return r;
+}
+
+// -----------------------------------------------------------------------------
+// A start on an edge with a wall on it: the robot can't half-step off it
+// either way, the first step would go through the wall.
+void checkStartOnWall(Planner& planner) {
+    Track track = generateTrack({ 4, 0.0, 2, MID_TOP, CENTER, 1 });
+    track.robotStartState = { 1, 1, MID_TOP, UP, true };
+    if (!track.hasHorizontalWall(1, 0)) {
+        track.toggleHorizontalWall(1, 0);
+    }
+    if (canDoPartialStepsToCenter(track, 1, 1, MID_TOP, UP)) {
+        cout << "start on a wall: partial steps to the center go through it\n";
+        failures++;
+    }
+    PlanResult got = planner.plan(track);
+    if (got.found && got.commands[0].distance == HALF_CELL) {
+        cout << "start on a wall: plan starts with " << commandText(got.commands[0]) << " through it\n";
+        failures++;
+    }
+}
+
+// With strafing slower than driving forward the heading at a checkpoint
+// matters, and the distance matrix leaves it free: the time an order is
+// given has to be its route's anyway.
+void checkOrderTimes() {
+    PlannerOptions options;
+    CostModel& model = options.costModel;
+    model.moveSec[PRIM_LEFT] = model.moveSec[PRIM_RIGHT] = 1.6;
+    model.moveSec[PRIM_TURN_LEFT] = model.moveSec[PRIM_TURN_RIGHT] = 0.7;
+    model.directionChangeSec = 0.2;
+    Planner planner(options);
+    for (uint32_t seed = 1; seed <= 50; seed++) {
+        Track track = generateTrack({ 5, 0.25, 6, MID_BOTTOM, CENTER, seed });
+        PermResult best = planner.findBestPermutation(track);
+        PlanResult plan = planner.plan(track);
+        if (plan.found && abs(plan.predictedSeconds - best.dist) > 1e-6) {
+            cout << "order times: track " << seed << " drives in " << plan.predictedSeconds
+                 << " s, its order says " << best.dist << " s\n";
+            failures++;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool loadBaseline(const string& path, map<string, double>& baseline) {
+    ifstream in(path);
+    if (!in) {
+        cout << "Can't open baseline " << path << "\n";
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line.substr(0, line.find('#')));
+        string scenario, metric;
+        double value;
+        if (fields >> scenario >> metric >> value) {
+            baseline[scenario + " " + metric] = value;
+        }
+    }
+    return true;
+}
+
+bool writeBaseline(const string& path, const map<string, double>& results) {
+    ofstream out(path);
+    if (!out) {
+        cout << "Can't write baseline " << path << "\n";
+        return false;
+    }
+    out << "# planner benchmark baseline: scenario metric value\n";
+    out << "# regenerate on the build machine with bench.exe --write-baseline " << path << "\n";
+    for (auto& [key, value] : results) {
+        out << key << " " << value << "\n";
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    string baselinePath;
+    string writePath;
+    double threshold = 0.25;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc)            baselinePath = argv[++i];
+        else if (arg == "--write-baseline" && i + 1 < argc) writePath = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)      threshold = atof(argv[++i]);
+        else {
+            cout << "usage: bench [--baseline FILE] [--write-baseline FILE] [--threshold 0.25]\n";
+            return 2;
+        }
+    }
+
+    PlannerOptions options;
+    Planner planner(options);
+
+    map<string, double> results;
+    cout << left << setw(24) << "scenario" << right
+         << setw(12) << "median ms" << setw(12) << "p99 ms"
+         << setw(12) << "allocs" << setw(12) << "nodes" << "\n";
+    for (const Scenario& sc : SCENARIOS) {
+        PlannerOptions scenarioOptions = options;
+        if (sc.searchTimeBudgetMs > 0) {
+            scenarioOptions.searchTimeBudgetMs = sc.searchTimeBudgetMs;
+        }
+        Planner scenarioPlanner(scenarioOptions);
+        map<string, double> r = runScenario(scenarioPlanner, sc);
+        string n = sc.name;
+        cout << left << setw(24) << n << right << fixed << setprecision(3)
+             << setw(12) << r[n + " total_median_ms"] << setw(12) << r[n + " total_p99_ms"]
+             << setprecision(0)
+             << setw(12) << r[n + " allocations_median"] << setw(12) << r[n + " nodes_median"] << "\n";
+        cout << "    path " << setprecision(3) << r[n + " path_median_ms"] << " / " << r[n + " path_p99_ms"]
+             << "   permutation " << r[n + " permutation_median_ms"] << " / " << r[n + " permutation_p99_ms"]
+             << "   commands " << r[n + " commands_median_ms"] << " / " << r[n + " commands_p99_ms"]
+             << "   edit " << r[n + " edit_median_ms"] << " / " << r[n + " edit_p99_ms"] << "\n";
+        results.insert(r.begin(), r.end());
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+    checkStartOnWall(planner);
+    checkOrderTimes();
+
+    if (!writePath.empty() && writeBaseline(writePath, results)) {
+        cout << "Wrote baseline " << writePath << "\n";
+    }
+
+    if (failures > 0) {
+        cout << failures << " wrong answer(s)\n";
+        return 1;
+    }
+    if (baselinePath.empty()) {
+        return 0;
+    }
+    map<string, double> baseline;
+    if (!loadBaseline(baselinePath, baseline)) {
+        return 2;
+    }
+
+    int regressions = 0;
+    for (auto& [key, value] : results) {
+        auto it = baseline.find(key);
+        if (it == baseline.end()) continue;
+        bool isP99 = key.find("_p99") != string::npos;
+        double limit = it->second * (1 + threshold * (isP99 ? P99_THRESHOLD_SCALE : 1.0));
+        if (key.find("_ms") != string::npos) {
+            limit = max(limit, it->second + TIME_SLACK_MS);
+        }
+        if (value > limit) {
+            cout << "REGRESSION " << key << ": " << value << " vs baseline " << it->second << "\n";
+            regressions++;
+        }
+    }
+    if (regressions > 0) {
+        cout << regressions << " regression(s) beyond " << threshold * 100 << "%\n";
+        return 1;
+    }
+    cout << "No regressions against " << baselinePath << "\n";
+    return 0;
+}
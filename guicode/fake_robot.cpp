@@ -0,0 +1,99 @@
+// -----------------------------------------------------------------------------
+// Pretend robot for trying plan uploads without hardware (Linux / macOS).
+//   fake_robot [eeprom file]
+// Opens a pseudo-terminal and prints its name; start the gui with
+// --port <that name> and press U. Every plan that arrives goes through the
+// same PlanReceiver as the sketch, gets written to the eeprom file (default
+// fake_eeprom.bin) and answered the way the robot answers.
+// Build (from guicode, or the "Build fake robot" task):
+//   g++ -std=c++17 -O2 fake_robot.cpp planner.cpp plan_upload.cpp -pthread -o fake_robot
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "plan_upload.h"
+#include "../arduinoIDEcode/plan_format.h"
+
+using namespace std;
+
+unsigned long millisNow() {
+    static auto started = chrono::steady_clock::now();
+    return (unsigned long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+}
+
+void reply(int fd, const string& line) {
+    string text = line + "\n";
+    if (write(fd, text.data(), text.size()) != (ssize_t)text.size()) {
+        cout << "Couldn't answer: " << line << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string eepromPath = argc > 1 ? argv[1] : "fake_eeprom.bin";
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        cout << "Can't open a pseudo-terminal.\n";
+        return 1;
+    }
+    string portName = ptsname(master);
+
+    // Keep our own end of the port open (raw, no echo) so the pty stays up
+    // between uploads.
+    int slave = open(portName.c_str(), O_RDWR | O_NOCTTY);
+    termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+        cout << "Can't open " << portName << ".\n";
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    cout << "Fake robot on " << portName << ", plans go to " << eepromPath << "\n" << flush;
+
+    PlanReceiver receiver;
+    uint8_t buf[256];
+    while (true) {
+        pollfd p = { master, POLLIN, 0 };
+        if (poll(&p, 1, 1000) <= 0) continue;
+        ssize_t n = read(master, buf, sizeof(buf));
+        if (n <= 0) continue;
+
+        for (ssize_t i = 0; i < n; i++) {
+            PlanReceiver::Status status = receiver.feed(buf[i], millisNow());
+            if (status == PlanReceiver::FAILED) {
+                cout << "Rejected a plan: " << receiver.error() << "\n" << flush;
+                reply(master, string("ERR ") + receiver.error());
+            }
+            if (status != PlanReceiver::DONE) continue;
+
+            ofstream out(eepromPath, ios::binary);
+            out.write((const char*)receiver.bytes(), receiver.size());
+            if (!out) {
+                reply(master, "ERR storage");
+                continue;
+            }
+
+            vector<uint8_t> bytes(receiver.bytes(), receiver.bytes() + receiver.size());
+            vector<TimedCommand> steps;
+            string error;
+            decodePlan(bytes, steps, error);
+            cout << "Stored " << steps.size() << " steps:\n";
+            for (const TimedCommand& c : steps) {
+                cout << "  " << timedCommandText(c) << "\n";
+            }
+            cout << flush;
+            reply(master, "OK " + to_string(steps.size()));
+        }
+    }
+}
@@ -2,21 +2,27 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <limits>
-#include <queue>
-#include <cmath>
 #include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
 
-using namespace std;
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
 
-// js for printing the total distance
-bool ends_with(const string& str, const string& suffix) {
-    if (str.size() < suffix.size()) {
-        return false;
-    }
-    return str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
-}
+#include "planner.h"
+#include "track_file.h"
+#include "plan_upload.h"
 
+using namespace std;
 
 struct Cell {
     bool isCheckpoint = false;
@@ -33,59 +39,94 @@ enum ToolMode {
     NONE
 };
 
-enum RobotOrientation {
-    UP,
-    RIGHT,
-    DOWN,
-    LEFT
-};
-
-enum PositionType {
-    CENTER,
-    MID_TOP,
-    MID_RIGHT,
-    MID_BOTTOM,
-    MID_LEFT,
-    CORNER_TOP_LEFT,
-    CORNER_TOP_RIGHT,
-    CORNER_BOTTOM_LEFT,
-    CORNER_BOTTOM_RIGHT
-};
-
-struct RobotState {
-    int gridX = 0;
-    int gridY = 0;
-    PositionType positionType = CENTER;
-    RobotOrientation orientation = UP;
-    bool valid = false;
-};
-
 // -----------------------------------------------------------------------------
 // Global variables
 int gSize = 4;
 int CELL_SIZE = 80;
 int SIDE_PANEL_WIDTH = 200;
+// small grids still need room for the buttons, status and frame meter
+int PANEL_MIN_HEIGHT = 380;
 int WINDOW_WIDTH;
 int WINDOW_HEIGHT;
 
-vector<vector<Cell>> grid;
-vector<vector<bool>> verticalWalls;
-vector<vector<bool>> horizontalWalls;
+// What each cell shows on screen. Walls, checkpoints and the robot live in
+// track, which is what the planner sees.
+struct GridStore {
+    vector<Cell> cells;
+
+    Cell& at(int x, int y) { return cells[y * gSize + x]; }
+};
 
-RobotState robotStartState;
-RobotState robotEndState;
+GridStore grid;
+Track track;
 
 bool robotStartSet = false;
 bool robotEndSet = false;
 
-vector<pair<int,int>> checkpoints;
-pair<int,int> endCheckpoint(-1, -1);
-
 ToolMode currentMode = NONE;
 
+// allowTurns, coalesceMoves, search time budget and move timings
+PlannerOptions plannerOptions;
+unique_ptr<Planner> planner;
+// run time to pace the commands to (--target), 0 = as fast as possible
+double targetSeconds = 0;
+// serial port U uploads the route to (--port)
+string uploadPort;
+// keeps the searches between edits so the route can follow along; only the
+// planning thread touches it
+unique_ptr<IncrementalPlanner> incremental;
+
+// -----------------------------------------------------------------------------
+// Single producer, single consumer handoff without locks. The writer fills
+// back() and publish() swaps it into the middle slot; the reader's update()
+// swaps the middle out if something new is there. Neither side ever waits
+// and the reader always gets the newest value.
+template <typename T>
+class TripleBuffer {
+public:
+    T& back() { return slots[backIdx]; }
+    void publish() { backIdx = middle.exchange(backIdx | FRESH) & INDEX; }
+
+    // true if front() changed
+    bool update() {
+        if (!(middle.load() & FRESH)) return false;
+        frontIdx = middle.exchange(frontIdx) & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIdx]; }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+    T slots[3];
+    int backIdx = 0;
+    int frontIdx = 1;
+    atomic<int> middle{2};
+};
+
+// What the planning thread hands the window: the best order so far while it
+// runs, the whole result once it is done.
+struct RouteSnapshot {
+    int generation = -1;              // planGeneration the plan was started for
+    bool done = false;
+    vector<pair<int,int>> waypoints;
+    double seconds = 0;
+    PlanResult result;
+    bool orderReused = false;
+};
+
+// Planning runs on planThread, one plan at a time. Every track edit cancels
+// the running plan and starts a new one on a copy of the track.
+TripleBuffer<RouteSnapshot> routeBuffer;
+thread planThread;
+unique_ptr<PlanProgress> planProgress;
+int planGeneration = 0;
+bool printCommandsWhenDone = false;
+
 struct Button {
     sf::RectangleShape shape;
     string label;
+    sf::Text text;
     ToolMode mode;
 };
 
@@ -95,16 +136,73 @@ Button findPathButton;
 sf::Font font;
 bool fontLoaded = false;
 
+// Everything on screen sits in a few vertex arrays that are rebuilt only
+// when what they show changes, so a frame is a handful of draw calls
+// however big the grid is.
+sf::VertexArray boardVertices(sf::Triangles);   // cells, grid lines, walls
+sf::VertexArray routeVertices(sf::Triangles);   // planned route on top of the board
+sf::VertexArray panelVertices(sf::Triangles);   // robot markers, side panel, buttons
+sf::Text statusText;
+bool sceneDirty = true;
+bool routeDirty = true;
+
+// Nothing is drawn unless something changed. While a plan runs the window
+// looks for progress this often; otherwise it sleeps in waitEvent.
+const int PROGRESS_POLL_MS = 50;
+
+// What drawing costs, at the bottom of the panel: how long the last frame
+// took and how much CPU the whole process used since the frame before it,
+// idle time included.
+struct FrameMeter {
+    sf::Clock sinceLastFrame;
+    double lastCpuSeconds = 0;
+    double frameMs = 0;
+    double cpuPercent = 0;
+    long long frames = 0;
+};
+
+FrameMeter frameMeter;
+sf::Text meterText;
+
 // -----------------------------------------------------------------------------
 // Initialize grid and wall containers
 void initGrid(int size) {
     gSize = size;
     WINDOW_WIDTH  = gSize * CELL_SIZE + SIDE_PANEL_WIDTH;
-    WINDOW_HEIGHT = gSize * CELL_SIZE;
+    WINDOW_HEIGHT = max(gSize * CELL_SIZE, PANEL_MIN_HEIGHT);
+
+    grid.cells.assign(gSize * gSize, Cell());
+    track = Track(gSize);
+    sceneDirty = true;
+}
+
+// -----------------------------------------------------------------------------
+// Show a loaded track in the editor
+void setTrack(const Track& loaded) {
+    initGrid(loaded.gSize);
+    track = loaded;
+    for (auto [x, y] : track.checkpoints) {
+        grid.at(x, y).isCheckpoint = true;
+    }
+    if (track.endCheckpoint.first >= 0) {
+        grid.at(track.endCheckpoint.first, track.endCheckpoint.second).isEndCheckpoint = true;
+    }
+    robotStartSet = track.robotStartState.valid;
+    robotEndSet = track.robotEndState.valid;
+    if (robotEndSet) {
+        grid.at(track.robotEndState.gridX, track.robotEndState.gridY).isRobotEnd = true;
+    }
+}
 
-    grid.assign(gSize, vector<Cell>(gSize));
-    verticalWalls.assign(gSize-1, vector<bool>(gSize, false));
-    horizontalWalls.assign(gSize, vector<bool>(gSize-1, false));
+// -----------------------------------------------------------------------------
+// Button text is laid out once, not every frame
+void initLabel(Button& b) {
+    if (!fontLoaded) return;
+    b.text.setFont(font);
+    b.text.setString(b.label);
+    b.text.setCharacterSize(14);
+    b.text.setFillColor(sf::Color::Black);
+    b.text.setPosition(b.shape.getPosition().x + 10, b.shape.getPosition().y + 10);
 }
 
 // -----------------------------------------------------------------------------
@@ -176,6 +274,24 @@ void initButtons() {
     findPathButton.shape.setFillColor(sf::Color(100, 200, 100));
     findPathButton.label = "Find Path";
     findPathButton.mode = NONE;
+
+    for (auto &b : buttons) {
+        initLabel(b);
+    }
+    initLabel(findPathButton);
+
+    if (fontLoaded) {
+        statusText.setFont(font);
+        statusText.setCharacterSize(14);
+        statusText.setFillColor(sf::Color::Black);
+        statusText.setPosition(findPathButton.shape.getPosition().x,
+                               findPathButton.shape.getPosition().y + btnHeight + 10);
+
+        meterText = statusText;
+        meterText.setCharacterSize(12);
+        meterText.setFillColor(sf::Color(90, 90, 90));
+        meterText.setPosition(x + margin, WINDOW_HEIGHT - 24.f);
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -188,6 +304,7 @@ void updateButtonColors() {
             b.shape.setFillColor(sf::Color(200, 200, 200));
         }
     }
+    sceneDirty = true;
 }
 
 // -----------------------------------------------------------------------------
@@ -197,639 +314,146 @@ void setMode(ToolMode mode) {
 }
 
 // -----------------------------------------------------------------------------
-// Check if there's a wall between two adjacent cells
-bool isWallBetween(int x1, int y1, int x2, int y2) {
-    // Make sure we are not out of range
-    if (x2 < 0 || x2 >= gSize || y2 < 0 || y2 >= gSize) {
-        // Out of grid => treat as blocked
-        return true;
-    }
+bool trackReady() {
+    return robotStartSet && robotEndSet && track.endCheckpoint.first >= 0;
+}
 
-    if (x1 == x2) {
-        if (y1 == y2 + 1 && y2 >= 0) {
-            return horizontalWalls[x1][y2];
-        }
-        else if (y1 + 1 == y2 && y1 >= 0) {
-            return horizontalWalls[x1][y1];
-        }
-    }
-    else if (y1 == y2) {
-        if (x1 == x2 + 1 && x2 >= 0) {
-            return verticalWalls[x2][y1];
-        }
-        else if (x1 + 1 == x2 && x1 >= 0) {
-            return verticalWalls[x1][y1];
+void printCommands(const PlanResult& result) {
+    if (!result.found) {
+        cout << result.error << "\n";
+        if (result.error != "No path found.") {
+            cout << "No path found.\n";
         }
+        return;
     }
-    // If not strictly adjacent in x or y, treat it as blocked:
-    return true;
-}
-
-// -----------------------------------------------------------------------------
-// Return neighbors (center-to-center) ignoring orientation, but checking walls.
-vector<pair<int,int>> getNeighborsIgnoreOrientation(int cx, int cy) {
-    vector<pair<int,int>> neighbors;
 
-    // Up
-    if (cy > 0 && !isWallBetween(cx, cy, cx, cy - 1)) {
-        neighbors.push_back({cx, cy - 1});
+    if (!result.provenOptimal) {
+        cout << "Another checkpoint order may be faster, the search couldn't rule them all out.\n";
     }
-    // Down
-    if (cy < gSize - 1 && !isWallBetween(cx, cy, cx, cy + 1)) {
-        neighbors.push_back({cx, cy + 1});
-    }
-    // Left
-    if (cx > 0 && !isWallBetween(cx, cy, cx - 1, cy)) {
-        neighbors.push_back({cx - 1, cy});
-    }
-    // Right
-    if (cx < gSize - 1 && !isWallBetween(cx, cy, cx + 1, cy)) {
-        neighbors.push_back({cx + 1, cy});
-    }
-
-    return neighbors;
-}
 
-// -----------------------------------------------------------------------------
-// BFS (center-to-center) ignoring orientation
-vector<pair<int,int>> shortestPathBetween(
-    pair<int,int> start, 
-    pair<int,int> goal, 
-    RobotOrientation
-) {
-    if (start == goal) {
-        return { start };
+    for (const MotionCommand &c : result.commands) {
+        cout << commandText(c) << "\n";
     }
+    cout << "total distance: " << result.totalDistance
+         << "   predicted time: " << result.predictedSeconds << " s\n";
 
-    vector<vector<bool>> visited(gSize, vector<bool>(gSize, false));
-    vector<vector<pair<int,int>>> parent(gSize, vector<pair<int,int>>(gSize, {-1, -1}));
-
-    queue<pair<int,int>> q;
-    q.push(start);
-    visited[start.second][start.first] = true;
-
-    bool found = false;
-
-    while (!q.empty()) {
-        auto [cx, cy] = q.front();
-        q.pop();
-
-        if (cx == goal.first && cy == goal.second) {
-            found = true;
-            break;
+    if (targetSeconds > 0) {
+        PacedSchedule paced = paceCommands(result.commands, plannerOptions.costModel, targetSeconds);
+        if (!paced.onTarget) {
+            cout << paced.error << "\n";
         }
-
-        auto nbrs = getNeighborsIgnoreOrientation(cx, cy);
-        for (auto &n : nbrs) {
-            int nx = n.first;
-            int ny = n.second;
-            if (!visited[ny][nx]) {
-                visited[ny][nx] = true;
-                parent[ny][nx] = {cx, cy};
-                q.push({nx, ny});
-            }
+        cout << "paced schedule, " << paced.predictedSeconds << " s for a " << targetSeconds
+             << " s target (move, pwm, drive ms, dwell ms):\n";
+        cout << "const TimedStep schedule[] = {\n";
+        for (const TimedCommand& c : paced.steps) {
+            cout << "  " << timedCommandText(c) << "\n";
         }
+        cout << "};\n";
     }
+    cout << "BFS runs: " << planner->totalBfsRuns() << ", workspace allocations: "
+         << planner->totalWorkspaceAllocations() << "\n";
+}
 
-    if (!found) {
-        return {};
+// Sends the finished route, paced like printCommands shows it, to the robot
+// on uploadPort. Blocks until the robot answers, a second or so.
+void uploadRoute() {
+    if (uploadPort.empty()) {
+        cout << "No serial port, start the gui with --port COM3 (or /dev/ttyACM0).\n";
+        return;
     }
-
-    // Reconstruct path
-    vector<pair<int,int>> path;
-    auto cur = goal;
-    while (!(cur.first == -1 && cur.second == -1)) {
-        path.push_back(cur);
-        cur = parent[cur.second][cur.first];
+    const RouteSnapshot& route = routeBuffer.front();
+    if (route.generation != planGeneration || !route.done || !route.result.found) {
+        cout << "No finished route to upload yet.\n";
+        return;
     }
-    reverse(path.begin(), path.end());
-    return path;
-}
 
-// -----------------------------------------------------------------------------
-// Concatenate multiple BFS sub-paths (avoiding duplication of repeated points)
-vector<pair<int,int>> concatPaths(const vector<vector<pair<int,int>>>& paths) {
-    vector<pair<int,int>> result;
-    for (size_t i = 0; i < paths.size(); i++) {
-        if (i == 0) {
-            result = paths[i];
-        }
-        else {
-            for (size_t j = 1; j < paths[i].size(); j++) {
-                result.push_back(paths[i][j]);
-            }
-        }
+    PacedSchedule paced = paceCommands(route.result.commands, plannerOptions.costModel, targetSeconds);
+    vector<uint8_t> bytes;
+    string reply;
+    if (!encodePlan(paced.steps, bytes, reply)) {
+        cout << reply << "\n";
+        return;
+    }
+    if (uploadPlan(uploadPort, bytes, reply)) {
+        cout << "Uploaded " << paced.steps.size() << " steps (" << bytes.size() << " bytes, "
+             << paced.predictedSeconds << " s) to " << uploadPort << ": " << reply << "\n";
+    } else {
+        cout << "Upload to " << uploadPort << " failed: " << reply << "\n";
     }
-    return result;
-}
-
-// -----------------------------------------------------------------------------
-// Simple path length (count of edges)
-double pathLength(const vector<pair<int,int>>& path) {
-    if (path.size() < 2) return 0;
-    return static_cast<double>(path.size() - 1);
-}
-
-// -----------------------------------------------------------------------------
-// Structure for BFS permutations among checkpoints
-struct PermResult {
-    double dist;
-    vector<pair<int,int>> finalPath;
-};
-
-// -----------------------------------------------------------------------------
-// all permutations of checkpoints, always finishing with the special end-checkpoint,
-// then finally going to robot end
-PermResult findBestPermutation() {
-    PermResult best;
-    best.dist = numeric_limits<double>::infinity();
-
-    // Copy the normal checkpoints (excluding end checkpoint)
-    vector<pair<int,int>> cpts = checkpoints;
-    cpts.erase(remove(cpts.begin(), cpts.end(), endCheckpoint), cpts.end());
-
-    vector<int> indices(cpts.size());
-    for (int i = 0; i < (int)cpts.size(); i++) {
-        indices[i] = i;
-    }
-
-    pair<int,int> startPos = {robotStartState.gridX, robotStartState.gridY};
-    RobotOrientation fixedO = robotStartState.orientation;
-
-    do {
-        bool valid = true;
-        vector<vector<pair<int,int>>> partialPaths;
-        pair<int,int> prev = startPos;
-
-        // 1) BFS from Start -> first checkpoint
-        if (!cpts.empty()) {
-            auto path = shortestPathBetween(prev, cpts[indices[0]], fixedO);
-            if (path.empty()) { 
-                valid = false; 
-            } else {
-                partialPaths.push_back(path);
-                prev = cpts[indices[0]];
-            }
-        }
-
-        // 2) BFS among the rest of the normal checkpoints
-        for (size_t i = 1; i < indices.size() && valid; i++) {
-            auto path = shortestPathBetween(prev, cpts[indices[i]], fixedO);
-            if (path.empty()) { 
-                valid = false; 
-                break; 
-            }
-            partialPaths.push_back(path);
-            prev = cpts[indices[i]];
-        }
-
-        // 3) BFS to the "end checkpoint" (special checkpoint)
-        if (valid) {
-            auto path = shortestPathBetween(prev, endCheckpoint, fixedO);
-            if (path.empty()) { 
-                valid = false; 
-            } else {
-                partialPaths.push_back(path);
-                prev = endCheckpoint;
-            }
-        }
-
-        // 4) BFS to the final robot end
-        if (valid) {
-            auto path = shortestPathBetween(prev, {robotEndState.gridX, robotEndState.gridY}, fixedO);
-            if (path.empty()) { 
-                valid = false; 
-            } else {
-                partialPaths.push_back(path);
-            }
-        }
-
-        if (!valid) continue;
-
-        // Merge all partial BFS paths
-        auto fullPath = concatPaths(partialPaths);
-        double dist = pathLength(fullPath);
-        if (dist < best.dist) {
-            best.dist = dist;
-            best.finalPath = fullPath;
-        }
-    } while (next_permutation(indices.begin(), indices.end()));
-
-    return best;
 }
 
 // -----------------------------------------------------------------------------
-// Move from corner/edge to center (or center to corner/edge)
-// checks that half-cell moves don't cross grid boundaries
-// or pass through wall.
-// -----------------------------------------------------------------------------
-
-// Helper to get the half-step commands from posType -> center
-vector<string> partialStepsFromPosTypeToCenter(PositionType posType, RobotOrientation ori) {
-    vector<string> cmds;
-
-    switch (ori) {
-    case UP:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("backward(0.5)");        break;
-        case MID_RIGHT:          cmds.push_back("left(0.5)");            break;
-        case MID_BOTTOM:         cmds.push_back("forward(0.5)");         break;
-        case MID_LEFT:           cmds.push_back("right(0.5)");           break;
-        case CORNER_TOP_LEFT:    
-            cmds.push_back("right(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        }
-        break;
-
-    case DOWN:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("forward(0.5)");         break;
-        case MID_RIGHT:          cmds.push_back("right(0.5)");           break;
-        case MID_BOTTOM:         cmds.push_back("backward(0.5)");        break;
-        case MID_LEFT:           cmds.push_back("left(0.5)");            break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        }
-        break;
-
-    case LEFT:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("right(0.5)");           break;
-        case MID_RIGHT:          cmds.push_back("backward(0.5)");        break;
-        case MID_BOTTOM:         cmds.push_back("left(0.5)");            break;
-        case MID_LEFT:           cmds.push_back("forward(0.5)");         break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        }
-        break;
-
-    case RIGHT:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("left(0.5)");            break;
-        case MID_RIGHT:          cmds.push_back("forward(0.5)");         break;
-        case MID_BOTTOM:         cmds.push_back("right(0.5)");           break;
-        case MID_LEFT:           cmds.push_back("backward(0.5)");        break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        }
-        break;
+// Background planning
+
+// Cancels the running plan, if any. Searches check the flag every few
+// thousand states, so this doesn't hold up the window.
+void stopPlanning() {
+    if (planThread.joinable()) {
+        planProgress->cancel = true;
+        planThread.join();
     }
-
-    return cmds;
 }
 
-// Helper to get the half-step commands from center -> posType
-vector<string> partialStepsFromCenterToPosType(PositionType posType, RobotOrientation ori) {
-    vector<string> cmds;
-
-    switch (ori) {
-    case UP:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("forward(0.5)");         break;
-        case MID_RIGHT:          cmds.push_back("right(0.5)");           break;
-        case MID_BOTTOM:         cmds.push_back("backward(0.5)");        break;
-        case MID_LEFT:           cmds.push_back("left(0.5)");            break;
-        case CORNER_TOP_LEFT:    
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        }
-        break;
-
-    case DOWN:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("backward(0.5)");        break;
-        case MID_RIGHT:          cmds.push_back("left(0.5)");            break;
-        case MID_BOTTOM:         cmds.push_back("forward(0.5)");         break;
-        case MID_LEFT:           cmds.push_back("right(0.5)");           break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("backward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("left(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("forward(0.5)");
-            cmds.push_back("right(0.5)");
-            break;
-        }
-        break;
-
-    case LEFT:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("left(0.5)");            break;
-        case MID_RIGHT:          cmds.push_back("forward(0.5)");         break;
-        case MID_BOTTOM:         cmds.push_back("right(0.5)");           break;
-        case MID_LEFT:           cmds.push_back("backward(0.5)");        break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        }
-        break;
-
-    case RIGHT:
-        switch (posType) {
-        case CENTER: break;
-        case MID_TOP:            cmds.push_back("right(0.5)");           break;
-        case MID_RIGHT:          cmds.push_back("backward(0.5)");        break;
-        case MID_BOTTOM:         cmds.push_back("left(0.5)");            break;
-        case MID_LEFT:           cmds.push_back("forward(0.5)");         break;
-        case CORNER_TOP_LEFT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_TOP_RIGHT:
-            cmds.push_back("left(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        case CORNER_BOTTOM_LEFT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("backward(0.5)");
-            break;
-        case CORNER_BOTTOM_RIGHT:
-            cmds.push_back("right(0.5)");
-            cmds.push_back("forward(0.5)");
-            break;
-        }
-        break;
+// Plans the current track on planThread. The thread only sees its own copy
+// of the track; it reports through routeBuffer, the window through planProgress.
+void startPlanning() {
+    stopPlanning();
+    planGeneration++;
+    if (!trackReady()) {
+        return;
     }
 
-    return cmds;
-}
-
-// -----------------------------------------------------------------------------
-// allow the robot to start on the very edge by focusing on cell
-// indices rather than raw float positions. fail if  cell index
-// invalid
-// -----------------------------------------------------------------------------
-
-bool canDoPartialStepsToCenter(int x, int y, PositionType posType, RobotOrientation ori) {
-    vector<string> stepCmds = partialStepsFromPosTypeToCenter(posType, ori);
-
-    double currentX = (double)x; 
-    double currentY = (double)y;
-
-    auto interpretMove = [&](const string& cmd) {
-        double dist = 0.0;
-        auto openParenPos = cmd.find('(');
-        auto closeParenPos = cmd.find(')');
-        if (openParenPos == string::npos || closeParenPos == string::npos) {
-            return false;  // malformed
-        }
-        string dir = cmd.substr(0, openParenPos);
-        string val = cmd.substr(openParenPos+1, closeParenPos - (openParenPos+1));
-        dist = stod(val);
-
-        // Apply move in grid coords
-        if (ori == UP) {
-            if (dir == "forward")    currentY -= dist;
-            else if (dir == "backward") currentY += dist;
-            else if (dir == "left")     currentX -= dist;
-            else if (dir == "right")    currentX += dist;
-        }
-        else if (ori == DOWN) {
-            if (dir == "forward")    currentY += dist;
-            else if (dir == "backward") currentY -= dist;
-            else if (dir == "left")     currentX += dist;
-            else if (dir == "right")    currentX -= dist;
-        }
-        else if (ori == LEFT) {
-            if (dir == "forward")    currentX -= dist;
-            else if (dir == "backward") currentX += dist;
-            else if (dir == "left")     currentY += dist;
-            else if (dir == "right")    currentY -= dist;
-        }
-        else if (ori == RIGHT) {
-            if (dir == "forward")    currentX += dist;
-            else if (dir == "backward") currentX -= dist;
-            else if (dir == "left")     currentY -= dist;
-            else if (dir == "right")    currentY += dist;
-        }
-
-        // Only fail if the integer cell index goes fully out of range
-        int cellX = (int)floor(currentX + 0.0001);
-        int cellY = (int)floor(currentY + 0.0001);
-        if (cellX < 0 || cellX >= gSize || cellY < 0 || cellY >= gSize) {
-            return false;
-        }
-        return true;
+    int generation = planGeneration;
+    planProgress = make_unique<PlanProgress>();
+    planProgress->onBetterTour = [generation](const vector<pair<int,int>>& waypoints, double seconds) {
+        RouteSnapshot& snap = routeBuffer.back();
+        snap.generation = generation;
+        snap.done = false;
+        snap.waypoints = waypoints;
+        snap.seconds = seconds;
+        routeBuffer.publish();
     };
 
-    for (auto &c : stepCmds) {
-        if (!interpretMove(c)) {
-            return false;
+    planThread = thread([generation, edited = track, progress = planProgress.get()] {
+        incremental->setTrack(edited);
+        PlanResult result = incremental->plan(progress);
+        if (result.cancelled) {
+            return;
         }
-    }
-
-    return true;
+        RouteSnapshot& snap = routeBuffer.back();
+        snap.generation = generation;
+        snap.done = true;
+        snap.waypoints = result.waypoints;
+        snap.seconds = result.predictedSeconds;
+        snap.result = move(result);
+        snap.orderReused = incremental->lastStats().orderReused;
+        routeBuffer.publish();
+    });
 }
 
-// Same fix for center -> posType
-bool canDoPartialStepsFromCenter(int x, int y, PositionType posType, RobotOrientation ori) {
-    vector<string> stepCmds = partialStepsFromCenterToPosType(posType, ori);
-
-    double currentX = (double)x;
-    double currentY = (double)y;
-
-    auto interpretMove = [&](const string& cmd) {
-        double dist = 0.0;
-        auto openParenPos = cmd.find('(');
-        auto closeParenPos = cmd.find(')');
-        if (openParenPos == string::npos || closeParenPos == string::npos) {
-            return false; 
-        }
-        string dir = cmd.substr(0, openParenPos);
-        string val = cmd.substr(openParenPos+1, closeParenPos - (openParenPos+1));
-        dist = stod(val);
-
-        if (ori == UP) {
-            if (dir == "forward")    currentY -= dist;
-            else if (dir == "backward") currentY += dist;
-            else if (dir == "left")     currentX -= dist;
-            else if (dir == "right")    currentX += dist;
-        }
-        else if (ori == DOWN) {
-            if (dir == "forward")    currentY += dist;
-            else if (dir == "backward") currentY -= dist;
-            else if (dir == "left")     currentX += dist;
-            else if (dir == "right")    currentX -= dist;
-        }
-        else if (ori == LEFT) {
-            if (dir == "forward")    currentX -= dist;
-            else if (dir == "backward") currentX += dist;
-            else if (dir == "left")     currentY += dist;
-            else if (dir == "right")    currentY -= dist;
-        }
-        else if (ori == RIGHT) {
-            if (dir == "forward")    currentX += dist;
-            else if (dir == "backward") currentX -= dist;
-            else if (dir == "left")     currentY -= dist;
-            else if (dir == "right")    currentY += dist;
-        }
-
-        int cellX = (int)floor(currentX + 0.0001);
-        int cellY = (int)floor(currentY + 0.0001);
-        if (cellX < 0 || cellX >= gSize || cellY < 0 || cellY >= gSize) {
-            return false;
-        }
-        return true;
-    };
-
-    for (auto &c : stepCmds) {
-        if (!interpretMove(c)) {
-            return false;
-        }
+// Picks up whatever the planning thread published since the last frame
+void collectPlan() {
+    if (!routeBuffer.update()) {
+        return;
     }
-
-    return true;
-}
-
-// -----------------------------------------------------------------------------
-// Convert  final BFS path from center to center into the robot commands
-// plus partial steps at start and end.
-vector<string> pathToCommands(const vector<pair<int,int>>& path, RobotOrientation ori) {
-    if (path.empty()) {
-        return {};
+    routeDirty = true;
+    const RouteSnapshot& route = routeBuffer.front();
+    if (route.generation != planGeneration || !route.done) {
+        return;
     }
 
-    vector<string> commands;
-
-    // 1) Partial steps from actual start positionType to the cell center
-    vector<string> prefix = partialStepsFromPosTypeToCenter(robotStartState.positionType, ori);
-    commands.insert(commands.end(), prefix.begin(), prefix.end());
-
-    // 2) Convert BFS center-to-center path into movement commands
-    for (size_t i = 0; i + 1 < path.size(); i++) {
-        auto [px, py] = path[i];
-        auto [nx, ny] = path[i+1];
-
-        int dx = nx - px;
-        int dy = ny - py;
-
-        if (ori == UP) {
-            if (dx == 0 && dy == -1) commands.push_back("forward(1)");
-            else if (dx == 0 && dy == 1) commands.push_back("backward(1)");
-            else if (dx == -1 && dy == 0) commands.push_back("left(1)");
-            else if (dx == 1 && dy == 0) commands.push_back("right(1)");
-        }
-        else if (ori == DOWN) {
-            if (dx == 0 && dy == 1) commands.push_back("forward(1)");
-            else if (dx == 0 && dy == -1) commands.push_back("backward(1)");
-            else if (dx == 1 && dy == 0) commands.push_back("left(1)");
-            else if (dx == -1 && dy == 0) commands.push_back("right(1)");
-        }
-        else if (ori == LEFT) {
-            if (dx == -1 && dy == 0) commands.push_back("forward(1)");
-            else if (dx == 1 && dy == 0) commands.push_back("backward(1)");
-            else if (dx == 0 && dy == 1) commands.push_back("left(1)");
-            else if (dx == 0 && dy == -1) commands.push_back("right(1)");
-        }
-        else if (ori == RIGHT) {
-            if (dx == 1 && dy == 0) commands.push_back("forward(1)");
-            else if (dx == -1 && dy == 0) commands.push_back("backward(1)");
-            else if (dx == 0 && dy == -1) commands.push_back("left(1)");
-            else if (dx == 0 && dy == 1) commands.push_back("right(1)");
-        }
+    const PlanResult& result = route.result;
+    if (result.found) {
+        cout << "route: " << result.predictedSeconds << " s, " << result.commands.size()
+             << " commands (" << result.stats.elapsedMs << " ms"
+             << (route.orderReused ? ", same order" : "") << ")\n";
+    } else {
+        cout << "route: " << result.error << "\n";
+    }
+    if (printCommandsWhenDone) {
+        printCommandsWhenDone = false;
+        printCommands(result);
     }
-
-    // 3) Partial steps from the center to the end positionType
-    vector<string> suffix = partialStepsFromCenterToPosType(robotEndState.positionType, ori);
-    commands.insert(commands.end(), suffix.begin(), suffix.end());
-
-    return commands;
 }
 
 // -----------------------------------------------------------------------------
@@ -843,57 +467,19 @@ void handleSidePanelClick(int mx, int my) {
     }
 
     if (findPathButton.shape.getGlobalBounds().contains(mx, my)) {
-        if (!robotStartSet || !robotEndSet || endCheckpoint.first < 0) {
+        if (!trackReady()) {
             cout << "Not all conditions met (start/end or end checkpoint not set).\n";
             return;
         }
 
-        // Check partial steps from start corner/edge => center
-        if (!canDoPartialStepsToCenter(robotStartState.gridX, robotStartState.gridY,
-                                       robotStartState.positionType,
-                                       robotStartState.orientation))
-        {
-            cout << "Cannot move from start corner/edge to center without going off-grid.\n";
-            cout << "No path found.\n";
-            return;
-        }
-
-        // BFS permutations among checkpoints
-        PermResult best = findBestPermutation();
-        if (best.finalPath.empty()) {
-            cout << "No path found.\n";
-            return;
-        }
-
-        // Check partial steps from final cell center => end corner/edge
-        auto [ex, ey] = best.finalPath.back(); 
-        if (!canDoPartialStepsFromCenter(ex, ey,
-                                         robotEndState.positionType,
-                                         robotStartState.orientation))
-        {
-            cout << "Cannot move from center to final corner/edge without going off-grid.\n";
-            cout << "No path found.\n";
-            return;
-        }
-
-        // If we made it here, we have a valid path
-        vector<string> commands = pathToCommands(best.finalPath, robotStartState.orientation);
-        if (commands.empty()) {
-            cout << "No path found.\n";
+        // the plan for this layout is done or on its way
+        const RouteSnapshot& route = routeBuffer.front();
+        if (route.generation == planGeneration && route.done) {
+            printCommands(route.result);
         } else {
-            float totaldistance = 0;
-            
-            for (const string &c : commands) {
-                if(ends_with(c, "(0.5)")){
-                    totaldistance += 0.5;
-                } else{
-                    totaldistance += 1;
-                }
-                cout << c << "\n";
-            }
-            cout << "total distance: " << totaldistance << "\n";
+            printCommandsWhenDone = true;
+            cout << "Still planning, commands follow when it's done.\n";
         }
-        exit(0);
     }
 }
 
@@ -940,20 +526,20 @@ void handleGridClick(int mx, int my) {
         bool placedWall = false;
         // Vertical walls
         if (localX < threshold && gx > 0) {
-            verticalWalls[gx-1][gy] = !verticalWalls[gx-1][gy];
+            track.toggleVerticalWall(gx-1, gy);
             placedWall = true;
         }
         else if (localX > CELL_SIZE - threshold && gx < gSize - 1) {
-            verticalWalls[gx][gy] = !verticalWalls[gx][gy];
+            track.toggleVerticalWall(gx, gy);
             placedWall = true;
         }
         // Horizontal walls
         else if (localY < threshold && gy > 0) {
-            horizontalWalls[gx][gy-1] = !horizontalWalls[gx][gy-1];
+            track.toggleHorizontalWall(gx, gy-1);
             placedWall = true;
         }
         else if (localY > CELL_SIZE - threshold && gy < gSize - 1) {
-            horizontalWalls[gx][gy] = !horizontalWalls[gx][gy];
+            track.toggleHorizontalWall(gx, gy);
             placedWall = true;
         }
         if (!placedWall) {
@@ -964,53 +550,53 @@ void handleGridClick(int mx, int my) {
 
     switch (currentMode) {
     case PLACE_CHECKPOINT: {
-        bool wasCheckpoint = grid[gy][gx].isCheckpoint;
+        bool wasCheckpoint = grid.at(gx, gy).isCheckpoint;
         // If we toggle a checkpoint that was an end checkpoint, remove end checkpoint status
-        if ((gx == endCheckpoint.first) && (gy == endCheckpoint.second)) {
-            grid[gy][gx].isEndCheckpoint = false;
-            endCheckpoint = {-1, -1};
+        if ((gx == track.endCheckpoint.first) && (gy == track.endCheckpoint.second)) {
+            grid.at(gx, gy).isEndCheckpoint = false;
+            track.endCheckpoint = {-1, -1};
         }
 
         // Toggle normal checkpoint
-        grid[gy][gx].isCheckpoint = !wasCheckpoint;
-        if (grid[gy][gx].isCheckpoint) {
-            checkpoints.emplace_back(gx, gy);
+        grid.at(gx, gy).isCheckpoint = !wasCheckpoint;
+        if (grid.at(gx, gy).isCheckpoint) {
+            track.checkpoints.emplace_back(gx, gy);
         }
         else {
-            checkpoints.erase(remove(checkpoints.begin(), checkpoints.end(),
-                                          make_pair(gx, gy)), checkpoints.end());
+            track.checkpoints.erase(remove(track.checkpoints.begin(), track.checkpoints.end(),
+                                           make_pair(gx, gy)), track.checkpoints.end());
         }
     } break;
 
     case PLACE_END_CHECKPOINT: {
         // Remove the old end checkpoint if any
-        if (endCheckpoint.first >= 0) {
-            grid[endCheckpoint.second][endCheckpoint.first].isEndCheckpoint = false;
+        if (track.endCheckpoint.first >= 0) {
+            grid.at(track.endCheckpoint.first, track.endCheckpoint.second).isEndCheckpoint = false;
         }
-        grid[gy][gx].isEndCheckpoint = true;
-        endCheckpoint = {gx, gy};
+        grid.at(gx, gy).isEndCheckpoint = true;
+        track.endCheckpoint = {gx, gy};
         // Also remove it from normal checkpoint list if present
-        checkpoints.erase(remove(checkpoints.begin(), checkpoints.end(), endCheckpoint),
-                          checkpoints.end());
+        track.checkpoints.erase(remove(track.checkpoints.begin(), track.checkpoints.end(), track.endCheckpoint),
+                                track.checkpoints.end());
     } break;
 
     case PLACE_ROBOT_START: {
-        robotStartState.gridX = gx;
-        robotStartState.gridY = gy;
-        robotStartState.positionType = posType;
-        robotStartState.valid = true;
+        track.robotStartState.gridX = gx;
+        track.robotStartState.gridY = gy;
+        track.robotStartState.positionType = posType;
+        track.robotStartState.valid = true;
         robotStartSet = true;
     } break;
 
     case PLACE_ROBOT_END: {
-        if (robotEndState.valid) {
-            grid[robotEndState.gridY][robotEndState.gridX].isRobotEnd = false;
-        }
-        robotEndState.gridX = gx;
-        robotEndState.gridY = gy;
-        robotEndState.positionType = posType;
-        robotEndState.valid = true;
-        grid[gy][gx].isRobotEnd = true;
+        if (track.robotEndState.valid) {
+            grid.at(track.robotEndState.gridX, track.robotEndState.gridY).isRobotEnd = false;
+        }
+        track.robotEndState.gridX = gx;
+        track.robotEndState.gridY = gy;
+        track.robotEndState.positionType = posType;
+        track.robotEndState.valid = true;
+        grid.at(gx, gy).isRobotEnd = true;
         robotEndSet = true;
     } break;
 
@@ -1020,259 +606,425 @@ void handleGridClick(int mx, int my) {
 }
 
 // -----------------------------------------------------------------------------
-int main() {
-    cout << "Enter grid size (e.g., 4, 5, etc.): ";
-    cin >> gSize;
-    if (gSize < 2) {
-        cout << "Invalid grid size. Defaulting to 4.\n";
-        gSize = 4;
+// Same layout: a click that put something back where it was isn't an edit
+bool sameRobotState(const RobotState& a, const RobotState& b) {
+    return a.valid == b.valid && (!a.valid || (a.gridX == b.gridX && a.gridY == b.gridY
+                                                && a.positionType == b.positionType
+                                                && a.orientation == b.orientation));
+}
+
+bool sameTrack(const Track& a, const Track& b) {
+    return a.gSize == b.gSize && a.verticalWalls == b.verticalWalls
+        && a.horizontalWalls == b.horizontalWalls && a.checkpoints == b.checkpoints
+        && a.endCheckpoint == b.endCheckpoint
+        && sameRobotState(a.robotStartState, b.robotStartState)
+        && sameRobotState(a.robotEndState, b.robotEndState);
+}
+
+// Replan after an edit; the route line follows once the planner catches up
+void trackEdited() {
+    printCommandsWhenDone = false;
+    startPlanning();
+    sceneDirty = true;
+    routeDirty = true;
+}
+
+// -----------------------------------------------------------------------------
+// Geometry for the vertex arrays, all as triangles so one array can hold
+// rectangles, circles and thick lines alike
+void addRect(sf::VertexArray& va, float x, float y, float w, float h, sf::Color color) {
+    sf::Vector2f a(x, y), b(x + w, y), c(x + w, y + h), d(x, y + h);
+    for (sf::Vector2f p : { a, b, c, a, c, d }) {
+        va.append(sf::Vertex(p, color));
     }
+}
 
-    initGrid(gSize);
+void addCircle(sf::VertexArray& va, sf::Vector2f center, float radius, sf::Color color) {
+    const int segments = 24;
+    for (int i = 0; i < segments; i++) {
+        float a0 = 2 * 3.14159265f * i / segments;
+        float a1 = 2 * 3.14159265f * (i + 1) / segments;
+        va.append(sf::Vertex(center, color));
+        va.append(sf::Vertex(center + radius * sf::Vector2f(cos(a0), sin(a0)), color));
+        va.append(sf::Vertex(center + radius * sf::Vector2f(cos(a1), sin(a1)), color));
+    }
+}
 
-    cout << "Enter robot starting orientation (up, right, down, left): ";
-    string orientInput;
-    cin >> orientInput;
-    transform(orientInput.begin(), orientInput.end(), orientInput.begin(), ::tolower);
-    if (orientInput == "up") {
-        robotStartState.orientation = UP;
+void addLine(sf::VertexArray& va, sf::Vector2f from, sf::Vector2f to, float thickness, sf::Color color) {
+    sf::Vector2f d = to - from;
+    float len = sqrt(d.x * d.x + d.y * d.y);
+    if (len == 0) return;
+    sf::Vector2f n(-d.y / len * thickness / 2, d.x / len * thickness / 2);
+    for (sf::Vector2f p : { from + n, to + n, to - n, from + n, to - n, from - n }) {
+        va.append(sf::Vertex(p, color));
     }
-    else if (orientInput == "right") {
-        robotStartState.orientation = RIGHT;
+}
+
+// Cell center in window coordinates
+sf::Vector2f cellCenter(pair<int,int> cell) {
+    return sf::Vector2f((cell.first + 0.5f) * CELL_SIZE, (cell.second + 0.5f) * CELL_SIZE);
+}
+
+// Where on its cell a robot marker sits
+sf::Vector2f markerPosition(const RobotState& state) {
+    float rx = state.gridX * CELL_SIZE;
+    float ry = state.gridY * CELL_SIZE;
+
+    switch (state.positionType) {
+    case CENTER:
+        rx += CELL_SIZE / 2.f;
+        ry += CELL_SIZE / 2.f;
+        break;
+    case MID_TOP:
+        rx += CELL_SIZE / 2.f;
+        break;
+    case MID_RIGHT:
+        rx += CELL_SIZE;
+        ry += CELL_SIZE / 2.f;
+        break;
+    case MID_BOTTOM:
+        rx += CELL_SIZE / 2.f;
+        ry += CELL_SIZE;
+        break;
+    case MID_LEFT:
+        ry += CELL_SIZE / 2.f;
+        break;
+    case CORNER_TOP_LEFT:
+        break;
+    case CORNER_TOP_RIGHT:
+        rx += CELL_SIZE;
+        break;
+    case CORNER_BOTTOM_LEFT:
+        ry += CELL_SIZE;
+        break;
+    case CORNER_BOTTOM_RIGHT:
+        rx += CELL_SIZE;
+        ry += CELL_SIZE;
+        break;
     }
-    else if (orientInput == "down") {
-        robotStartState.orientation = DOWN;
+    return sf::Vector2f(rx, ry);
+}
+
+void addButton(const Button& b) {
+    sf::Vector2f pos = b.shape.getPosition();
+    sf::Vector2f size = b.shape.getSize();
+    addRect(panelVertices, pos.x, pos.y, size.x, size.y, b.shape.getFillColor());
+}
+
+// -----------------------------------------------------------------------------
+// Cells, grid lines, walls, robot markers and the side panel
+void buildScene() {
+    boardVertices.clear();
+    float board = static_cast<float>(gSize * CELL_SIZE);
+
+    for (int y = 0; y < gSize; y++) {
+        for (int x = 0; x < gSize; x++) {
+            sf::Color fill = sf::Color::White;
+            if (grid.at(x, y).isCheckpoint) {
+                fill = sf::Color::Green;
+            }
+            else if (grid.at(x, y).isEndCheckpoint) {
+                fill = sf::Color::Cyan;
+            }
+            addRect(boardVertices, x * CELL_SIZE, y * CELL_SIZE, CELL_SIZE, CELL_SIZE, fill);
+        }
     }
-    else if (orientInput == "left") {
-        robotStartState.orientation = LEFT;
+
+    // grid lines
+    for (int i = 0; i <= gSize; i++) {
+        float at = static_cast<float>(i * CELL_SIZE);
+        addRect(boardVertices, at - 1, 0, 2, board, sf::Color::Black);
+        addRect(boardVertices, 0, at - 1, board, 2, sf::Color::Black);
     }
-    else {
-        cout << "Invalid orientation. Defaulting to UP.\n";
-        robotStartState.orientation = UP;
+
+    for (int y = 0; y < gSize; y++) {
+        for (int x = 0; x < gSize; x++) {
+            if (x < gSize - 1 && track.hasVerticalWall(x, y)) {
+                addRect(boardVertices, (x + 1) * CELL_SIZE - 2, y * CELL_SIZE, 4, CELL_SIZE, sf::Color::Black);
+            }
+            if (y < gSize - 1 && track.hasHorizontalWall(x, y)) {
+                addRect(boardVertices, x * CELL_SIZE, (y + 1) * CELL_SIZE - 2, CELL_SIZE, 4, sf::Color::Black);
+            }
+        }
     }
 
-    sf::RenderWindow window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "Robot Tour GUI");
-    window.setFramerateLimit(60);
+    panelVertices.clear();
+    if (robotEndSet) {
+        addCircle(panelVertices, markerPosition(track.robotEndState), 10.f, sf::Color::Red);
+    }
+    if (robotStartSet) {
+        sf::Vector2f at = markerPosition(track.robotStartState);
+        addCircle(panelVertices, at, 12.f, sf::Color::Blue);
 
-    if (!font.loadFromFile("arial.ttf")) {
-        cout << "Warning: Failed to load arial.ttf. No text will be displayed.\n";
+        // Indicate orientation with a small line
+        const sf::Vector2f dir[4] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+        addLine(panelVertices, at, at + 20.f * dir[track.robotStartState.orientation], 2.f, sf::Color::Blue);
     }
-    else {
-        fontLoaded = true;
+
+    addRect(panelVertices, board, 0, SIDE_PANEL_WIDTH, WINDOW_HEIGHT, sf::Color(220, 220, 220));
+    for (auto &b : buttons) {
+        addButton(b);
     }
+    addButton(findPathButton);
+    sceneDirty = false;
+}
 
-    initButtons();
-    updateButtonColors();
+// The finished route through every cell, or while the planner is still going
+// the best checkpoint order so far as straight lines.
+void buildRoute() {
+    routeVertices.clear();
+    routeDirty = false;
+    const RouteSnapshot& route = routeBuffer.front();
+    if (!trackReady() || route.generation < 0) {
+        return;
+    }
 
-    while (window.isOpen()) {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed) {
-                window.close();
+    bool finished = route.done && route.result.found && route.generation == planGeneration;
+    const vector<pair<int,int>>& cells = finished ? route.result.path : route.waypoints;
+    sf::Color color = finished ? sf::Color(255, 140, 0) : sf::Color(160, 160, 160);
+    for (size_t i = 0; i + 1 < cells.size(); i++) {
+        addLine(routeVertices, cellCenter(cells[i]), cellCenter(cells[i + 1]), 3.f, color);
+    }
+}
+
+string secondsText(double seconds) {
+    ostringstream out;
+    out << fixed << setprecision(2) << seconds << " s";
+    return out.str();
+}
+
+// One line under the buttons: how far planning got, or the route's time
+string planStatus() {
+    if (!trackReady()) {
+        return "";
+    }
+    const RouteSnapshot& route = routeBuffer.front();
+    if (route.generation == planGeneration && route.done) {
+        if (!route.result.found) return route.result.error;
+        return "route " + secondsText(route.result.predictedSeconds);
+    }
+
+    int best = planProgress ? planProgress->bestTourMs.load() : -1;
+    if (best >= 0) {
+        return "planning, best " + secondsText(best / 1000.0);
+    }
+    int done = planProgress ? planProgress->legsSearched.load() : 0;
+    int total = planProgress ? planProgress->legsTotal.load() : 0;
+    return "planning " + to_string(done) + "/" + to_string(total);
+}
+
+// -----------------------------------------------------------------------------
+// CPU time used by the whole process so far, planner threads included
+double processCpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    auto seconds = [](FILETIME t) {
+        return (double)(((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) / 1e7;
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// A plan for the current layout is still running, so progress can show up
+bool planInProgress() {
+    const RouteSnapshot& route = routeBuffer.front();
+    return trackReady() && planThread.joinable()
+        && !(route.generation == planGeneration && route.done);
+}
+
+// -----------------------------------------------------------------------------
+// Returns true if the event changed anything on screen
+bool handleEvent(sf::RenderWindow& window, const sf::Event& event) {
+    if (event.type == sf::Event::Closed) {
+        window.close();
+    }
+    else if (event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus) {
+        // the window contents may have been lost
+        return true;
+    }
+    else if (event.type == sf::Event::KeyPressed) {
+        if (event.key.code == sf::Keyboard::S && saveTrackText("track.txt", track)) {
+            cout << "Saved track.txt\n";
+        }
+        else if (event.key.code == sf::Keyboard::B && saveTrackBinary("track.rtb", track)) {
+            cout << "Saved track.rtb\n";
+        }
+        else if (event.key.code == sf::Keyboard::U) {
+            uploadRoute();
+        }
+    }
+    else if (event.type == sf::Event::MouseButtonPressed) {
+        if (event.mouseButton.button == sf::Mouse::Left) {
+            int mx = event.mouseButton.x;
+            int my = event.mouseButton.y;
+            if (mx > gSize * CELL_SIZE) {
+                handleSidePanelClick(mx, my);
             }
-            else if (event.type == sf::Event::MouseButtonPressed) {
-                if (event.mouseButton.button == sf::Mouse::Left) {
-                    int mx = event.mouseButton.x;
-                    int my = event.mouseButton.y;
-                    if (mx > gSize * CELL_SIZE) {
-                        handleSidePanelClick(mx, my);
-                    }
-                    else {
-                        if (currentMode != NONE) {
-                            handleGridClick(mx, my);
-                        }
+            else {
+                if (currentMode != NONE) {
+                    Track before = track;
+                    handleGridClick(mx, my);
+                    if (!sameTrack(before, track)) {
+                        trackEdited();
                     }
                 }
             }
         }
+    }
+    return false;
+}
 
-        window.clear(sf::Color::White);
+// -----------------------------------------------------------------------------
+// Rebuilds whatever is dirty and draws the whole window from the cached
+// arrays; it's a few draw calls, cheaper than tracking damaged rectangles
+void drawFrame(sf::RenderWindow& window) {
+    sf::Clock frameClock;
+    if (sceneDirty) {
+        buildScene();
+    }
+    if (routeDirty) {
+        buildRoute();
+    }
 
-        // Draw grid cells
-        for (int y = 0; y < gSize; y++) {
-            for (int x = 0; x < gSize; x++) {
-                sf::RectangleShape cellRect(sf::Vector2f(CELL_SIZE, CELL_SIZE));
-                cellRect.setPosition(static_cast<float>(x) * CELL_SIZE,
-                                     static_cast<float>(y) * CELL_SIZE);
-                cellRect.setOutlineThickness(1.f);
-                cellRect.setOutlineColor(sf::Color::Black);
+    if (fontLoaded) {
+        ostringstream meter;
+        meter << fixed << setprecision(2) << "frame " << frameMeter.frameMs << " ms  cpu "
+              << setprecision(1) << frameMeter.cpuPercent << "%  #" << frameMeter.frames;
+        meterText.setString(meter.str());
+    }
 
-                if (grid[y][x].isCheckpoint) {
-                    cellRect.setFillColor(sf::Color::Green);
-                }
-                else if (grid[y][x].isEndCheckpoint) {
-                    cellRect.setFillColor(sf::Color::Cyan);
-                }
-                else {
-                    cellRect.setFillColor(sf::Color::White);
-                }
-                window.draw(cellRect);
-            }
+    window.clear(sf::Color::White);
+    window.draw(boardVertices);
+    window.draw(routeVertices);
+    window.draw(panelVertices);
+    if (fontLoaded) {
+        for (auto &b : buttons) {
+            window.draw(b.text);
         }
+        window.draw(findPathButton.text);
+        window.draw(statusText);
+        window.draw(meterText);
+    }
+    window.display();
+
+    frameMeter.frames++;
+    frameMeter.frameMs = frameClock.getElapsedTime().asMicroseconds() / 1000.0;
+    double cpu = processCpuSeconds();
+    double wall = frameMeter.sinceLastFrame.restart().asSeconds();
+    frameMeter.cpuPercent = wall > 0 ? 100 * (cpu - frameMeter.lastCpuSeconds) / wall : 0;
+    frameMeter.lastCpuSeconds = cpu;
+}
 
-        // Draw vertical walls
-        for (int x = 0; x < gSize - 1; x++) {
-            for (int y = 0; y < gSize; y++) {
-                if (verticalWalls[x][y]) {
-                    sf::RectangleShape wall(sf::Vector2f(4, static_cast<float>(CELL_SIZE)));
-                    wall.setPosition(static_cast<float>((x + 1) * CELL_SIZE - 2),
-                                     static_cast<float>(y * CELL_SIZE));
-                    wall.setFillColor(sf::Color::Black);
-                    window.draw(wall);
-                }
-            }
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    // optional: gui.exe [track file] [search time budget in ms] [--target seconds] [--port COM3]
+    string trackPath;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--target" && i + 1 < argc) {
+            targetSeconds = max(0.0, atof(argv[++i]));
+        } else if (arg == "--port" && i + 1 < argc) {
+            uploadPort = argv[++i];
+        } else if (!arg.empty() && all_of(arg.begin(), arg.end(), ::isdigit)) {
+            plannerOptions.searchTimeBudgetMs = max(1, stoi(arg));
+        } else {
+            trackPath = arg;
         }
+    }
 
-        // Draw horizontal walls
-        for (int x = 0; x < gSize; x++) {
-            for (int y = 0; y < gSize - 1; y++) {
-                if (horizontalWalls[x][y]) {
-                    sf::RectangleShape wall(sf::Vector2f(static_cast<float>(CELL_SIZE), 4.f));
-                    wall.setPosition(static_cast<float>(x * CELL_SIZE),
-                                     static_cast<float>((y + 1) * CELL_SIZE - 2));
-                    wall.setFillColor(sf::Color::Black);
-                    window.draw(wall);
-                }
-            }
-        }
+    if (loadCostModel("calibration.txt", plannerOptions.costModel)) {
+        cout << "Loaded move timings from calibration.txt\n";
+    } else {
+        cout << "No calibration.txt, using the sketch's default timings.\n";
+    }
 
-        // Draw robot end if set
-        if (robotEndSet) {
-            sf::CircleShape endCircle(10.f);
-            float rx = robotEndState.gridX * CELL_SIZE;
-            float ry = robotEndState.gridY * CELL_SIZE;
-
-            switch (robotEndState.positionType) {
-            case CENTER:
-                rx += CELL_SIZE / 2.f;
-                ry += CELL_SIZE / 2.f;
-                break;
-            case MID_TOP:
-                rx += CELL_SIZE / 2.f;
-                break;
-            case MID_RIGHT:
-                rx += CELL_SIZE;
-                ry += CELL_SIZE / 2.f;
-                break;
-            case MID_BOTTOM:
-                rx += CELL_SIZE / 2.f;
-                ry += CELL_SIZE;
-                break;
-            case MID_LEFT:
-                ry += CELL_SIZE / 2.f;
-                break;
-            case CORNER_TOP_LEFT:
-                break;
-            case CORNER_TOP_RIGHT:
-                rx += CELL_SIZE;
-                break;
-            case CORNER_BOTTOM_LEFT:
-                ry += CELL_SIZE;
-                break;
-            case CORNER_BOTTOM_RIGHT:
-                rx += CELL_SIZE;
-                ry += CELL_SIZE;
-                break;
-            }
+    planner = make_unique<Planner>(plannerOptions);
+    incremental = make_unique<IncrementalPlanner>(*planner);
 
-            endCircle.setFillColor(sf::Color::Red);
-            endCircle.setPosition(rx - 10.f, ry - 10.f);
-            window.draw(endCircle);
+    Track loaded;
+    if (!trackPath.empty() && loadTrack(trackPath, loaded)) {
+        setTrack(loaded);
+        cout << "Loaded track from " << trackPath << "\n";
+        startPlanning();
+    }
+    else {
+        cout << "Enter grid size (e.g., 4, 5, etc.): ";
+        cin >> gSize;
+        if (gSize < 2) {
+            cout << "Invalid grid size. Defaulting to 4.\n";
+            gSize = 4;
         }
 
-        // Draw robot start if set
-        if (robotStartSet) {
-            sf::CircleShape robot(12.f);
-            float rx = robotStartState.gridX * CELL_SIZE;
-            float ry = robotStartState.gridY * CELL_SIZE;
-
-            switch (robotStartState.positionType) {
-            case CENTER:
-                rx += CELL_SIZE / 2.f;
-                ry += CELL_SIZE / 2.f;
-                break;
-            case MID_TOP:
-                rx += CELL_SIZE / 2.f;
-                break;
-            case MID_RIGHT:
-                rx += CELL_SIZE;
-                ry += CELL_SIZE / 2.f;
-                break;
-            case MID_BOTTOM:
-                rx += CELL_SIZE / 2.f;
-                ry += CELL_SIZE;
-                break;
-            case MID_LEFT:
-                ry += CELL_SIZE / 2.f;
-                break;
-            case CORNER_TOP_LEFT:
-                break;
-            case CORNER_TOP_RIGHT:
-                rx += CELL_SIZE;
-                break;
-            case CORNER_BOTTOM_LEFT:
-                ry += CELL_SIZE;
-                break;
-            case CORNER_BOTTOM_RIGHT:
-                rx += CELL_SIZE;
-                ry += CELL_SIZE;
-                break;
-            }
+        initGrid(gSize);
 
-            robot.setFillColor(sf::Color::Blue);
-            robot.setPosition(rx - 12.f, ry - 12.f);
-            window.draw(robot);
-
-            // Indicate orientation with a small line
-            sf::RectangleShape dirLine(sf::Vector2f(20, 2));
-            dirLine.setOrigin(0.f, 1.f);
-            dirLine.setPosition(rx, ry);
-            switch (robotStartState.orientation) {
-                case UP:    dirLine.setRotation(270.f); break;
-                case RIGHT: dirLine.setRotation(0.f);   break;
-                case DOWN:  dirLine.setRotation(90.f);  break;
-                case LEFT:  dirLine.setRotation(180.f); break;
-            }
-            dirLine.setFillColor(sf::Color::Blue);
-            window.draw(dirLine);
+        cout << "Enter robot starting orientation (up, right, down, left): ";
+        string orientInput;
+        cin >> orientInput;
+        transform(orientInput.begin(), orientInput.end(), orientInput.begin(), ::tolower);
+        if (orientInput == "up") {
+            track.robotStartState.orientation = UP;
+        }
+        else if (orientInput == "right") {
+            track.robotStartState.orientation = RIGHT;
+        }
+        else if (orientInput == "down") {
+            track.robotStartState.orientation = DOWN;
+        }
+        else if (orientInput == "left") {
+            track.robotStartState.orientation = LEFT;
+        }
+        else {
+            cout << "Invalid orientation. Defaulting to UP.\n";
+            track.robotStartState.orientation = UP;
         }
+    }
+    cout << "Press S to save the track as track.txt, B for binary track.rtb, U to upload the route.\n";
 
-        // Draw side panel
-        sf::RectangleShape panel(sf::Vector2f(static_cast<float>(SIDE_PANEL_WIDTH),
-                                              static_cast<float>(WINDOW_HEIGHT)));
-        panel.setPosition(static_cast<float>(gSize * CELL_SIZE), 0.f);
-        panel.setFillColor(sf::Color(220, 220, 220));
-        window.draw(panel);
+    sf::RenderWindow window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "Robot Tour GUI");
 
-        // Draw main buttons
-        for (auto &b : buttons) {
-            window.draw(b.shape);
-            if (fontLoaded) {
-                sf::Text txt;
-                txt.setFont(font);
-                txt.setString(b.label);
-                txt.setCharacterSize(14);
-                txt.setFillColor(sf::Color::Black);
-                txt.setPosition(b.shape.getPosition().x + 10, b.shape.getPosition().y + 10);
-                window.draw(txt);
-            }
+    if (!font.loadFromFile("arial.ttf")) {
+        cout << "Warning: Failed to load arial.ttf. No text will be displayed.\n";
+    }
+    else {
+        fontLoaded = true;
+    }
+
+    initButtons();
+    updateButtonColors();
+
+    bool redraw = true;
+    string shownStatus;
+    frameMeter.lastCpuSeconds = processCpuSeconds();
+    while (window.isOpen()) {
+        sf::Event event;
+        if (planInProgress()) {
+            // the planning thread can't wake waitEvent, so look in now and then
+            sf::sleep(sf::milliseconds(PROGRESS_POLL_MS));
+        }
+        else if (!redraw && window.waitEvent(event)) {
+            redraw |= handleEvent(window, event);
+        }
+        while (window.pollEvent(event)) {
+            redraw |= handleEvent(window, event);
         }
 
-        // Draw "Find Path" button
-        window.draw(findPathButton.shape);
-        if (fontLoaded) {
-            sf::Text txt;
-            txt.setFont(font);
-            txt.setString(findPathButton.label);
-            txt.setCharacterSize(14);
-            txt.setFillColor(sf::Color::Black);
-            txt.setPosition(findPathButton.shape.getPosition().x + 10,
-                            findPathButton.shape.getPosition().y + 10);
-            window.draw(txt);
+        collectPlan();
+        string status = planStatus();
+        if (status != shownStatus) {
+            shownStatus = status;
+            statusText.setString(status);
+            redraw = true;
         }
 
-        window.display();
+        if (window.isOpen() && (redraw || sceneDirty || routeDirty)) {
+            drawFrame(window);
+            redraw = false;
+        }
     }
 
+    stopPlanning();
     return 0;
 }
@@ -0,0 +1,204 @@
+#include "plan_upload.h"
+
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "../arduinoIDEcode/plan_format.h"
+
+using namespace std;
+
+// Serial.begin() in the sketch
+const int SERIAL_BAUD = 9600;
+
+// -----------------------------------------------------------------------------
+// Encoding
+bool encodePlan(const vector<TimedCommand>& steps, vector<uint8_t>& bytes, string& error) {
+    if (steps.size() > (size_t)PLAN_MAX_STEPS) {
+        error = "Plan has " + to_string(steps.size()) + " steps, the robot takes "
+                + to_string(PLAN_MAX_STEPS) + ".";
+        return false;
+    }
+
+    PlanHeader header;
+    memcpy(header.magic, PLAN_MAGIC, 4);
+    header.version = PLAN_FORMAT_VERSION;
+    header.count = (uint8_t)steps.size();
+
+    vector<PlanStep> packed(steps.size());
+    for (size_t i = 0; i < steps.size(); i++) {
+        const TimedCommand& c = steps[i];
+        packed[i] = { c.command.prim, c.pwm, c.command.distance, c.driveMs, c.dwellMs };
+    }
+    header.checksum = planChecksum(header, packed.data());
+
+    bytes.resize(sizeof(header) + packed.size() * sizeof(PlanStep));
+    memcpy(bytes.data(), &header, sizeof(header));
+    if (!packed.empty()) {
+        memcpy(bytes.data() + sizeof(header), packed.data(), packed.size() * sizeof(PlanStep));
+    }
+    return true;
+}
+
+bool decodePlan(const vector<uint8_t>& bytes, vector<TimedCommand>& steps, string& error) {
+    if (const char* why = planError(bytes.data(), (int)bytes.size())) {
+        error = string("Bad plan: ") + why + ".";
+        return false;
+    }
+    PlanHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    steps.resize(header.count);
+    for (int i = 0; i < header.count; i++) {
+        PlanStep s;
+        memcpy(&s, bytes.data() + sizeof(header) + i * sizeof(PlanStep), sizeof(s));
+        steps[i] = { motion(s.move, s.distance), s.pwm, s.driveMs, s.dwellMs };
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Serial port, raw 8N1. Just enough to write a plan and read one line back.
+namespace {
+
+class SerialPort {
+public:
+    ~SerialPort() { close(); }
+
+    bool open(const string& port, string& error) {
+#ifdef _WIN32
+        handle = CreateFileA(("\\\\.\\" + port).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                             OPEN_EXISTING, 0, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            error = "Can't open " + port + ".";
+            return false;
+        }
+        DCB dcb = {};
+        dcb.DCBlength = sizeof(dcb);
+        GetCommState(handle, &dcb);
+        dcb.BaudRate = SERIAL_BAUD;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+        dcb.fDtrControl = DTR_CONTROL_ENABLE;
+        // a read returns as soon as anything arrived, or after 50 ms
+        COMMTIMEOUTS timeouts = {};
+        timeouts.ReadIntervalTimeout = MAXDWORD;
+        timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+        timeouts.ReadTotalTimeoutConstant = 50;
+        if (!SetCommState(handle, &dcb) || !SetCommTimeouts(handle, &timeouts)) {
+            error = "Can't set up " + port + ".";
+            return false;
+        }
+#else
+        fd = ::open(port.c_str(), O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            error = "Can't open " + port + ".";
+            return false;
+        }
+        termios tio;
+        if (tcgetattr(fd, &tio) != 0) {
+            error = port + " is not a serial port.";
+            return false;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B9600);
+        cfsetospeed(&tio, B9600);
+        tio.c_cflag |= CLOCAL | CREAD;
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            error = "Can't set up " + port + ".";
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    bool write(const uint8_t* data, size_t length) {
+#ifdef _WIN32
+        DWORD written = 0;
+        return WriteFile(handle, data, (DWORD)length, &written, nullptr) && written == length;
+#else
+        while (length > 0) {
+            ssize_t n = ::write(fd, data, length);
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+#endif
+    }
+
+    // whatever arrived within about 50 ms, 0 bytes if nothing did
+    int read(char* buf, int length) {
+#ifdef _WIN32
+        DWORD got = 0;
+        return ReadFile(handle, buf, length, &got, nullptr) ? (int)got : -1;
+#else
+        pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, 50) <= 0) return 0;
+        return (int)::read(fd, buf, length);
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
+
+} // namespace
+
+bool uploadPlan(const string& port, const vector<uint8_t>& bytes, string& reply, int timeoutMs) {
+    SerialPort serial;
+    if (!serial.open(port, reply)) {
+        return false;
+    }
+    if (!serial.write(bytes.data(), bytes.size())) {
+        reply = "Writing to " + port + " failed.";
+        return false;
+    }
+
+    // one line back: OK <count> or ERR <why>
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    string line;
+    char buf[64];
+    while (chrono::steady_clock::now() < deadline) {
+        int n = serial.read(buf, sizeof(buf));
+        if (n < 0) {
+            reply = "Reading from " + port + " failed.";
+            return false;
+        }
+        for (int i = 0; i < n; i++) {
+            if (buf[i] == '\r') continue;
+            if (buf[i] != '\n') {
+                line += buf[i];
+            } else if (line.rfind("OK", 0) == 0 || line.rfind("ERR", 0) == 0) {
+                reply = line;
+                return line.rfind("OK", 0) == 0;
+            } else {
+                line.clear();  // something else the sketch printed
+            }
+        }
+    }
+    reply = "No answer from the robot on " + port + ".";
+    return false;
+}
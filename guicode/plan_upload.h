@@ -0,0 +1,25 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Getting a plan onto the robot without reflashing: the schedule is packed
+// into the binary plan format (arduinoIDEcode/plan_format.h) and written to
+// the robot's serial port, which stores it in EEPROM and answers.
+// -----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "planner.h"
+
+// Packs a schedule. False with `error` set if it doesn't fit the format.
+bool encodePlan(const std::vector<TimedCommand>& steps, std::vector<uint8_t>& bytes, std::string& error);
+
+// Unpacks and checks a plan (what the robot would store). False with `error` set.
+bool decodePlan(const std::vector<uint8_t>& bytes, std::vector<TimedCommand>& steps, std::string& error);
+
+// Sends a packed plan to the robot on `port` (COM3, /dev/ttyACM0, or the pty
+// fake_robot prints) and waits for its "OK"/"ERR" line. True only for OK;
+// `reply` has the robot's answer or why there wasn't one.
+bool uploadPlan(const std::string& port, const std::vector<uint8_t>& bytes, std::string& reply,
+                int timeoutMs = 3000);
@@ -0,0 +1,2294 @@
+#include "planner.h"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <cmath>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+const char* PRIMITIVE_NAME[NUM_PRIMITIVES] = {
+    "forward", "backward", "left", "right", "turnLeft", "turnRight"
+};
+
+bool operator==(const MotionCommand& a, const MotionCommand& b) {
+    return a.prim == b.prim && a.distance == b.distance;
+}
+
+// "forward(2.5)", "turnLeft()"
+string commandText(const MotionCommand& c) {
+    ostringstream text;
+    text << PRIMITIVE_NAME[c.prim] << "(";
+    if (!isTurn(c.prim)) {
+        text << commandCells(c);
+    }
+    text << ")";
+    return text.str();
+}
+
+vector<string> commandTexts(const vector<MotionCommand>& commands) {
+    vector<string> texts;
+    texts.reserve(commands.size());
+    for (const MotionCommand& c : commands) {
+        texts.push_back(commandText(c));
+    }
+    return texts;
+}
+
+// -----------------------------------------------------------------------------
+// Cost model
+int CostModel::stepMs(int prim, int lastPrim, bool coalesceMoves, double cells) const {
+    bool extendsSegment = coalesceMoves && prim == lastPrim
+                          && prim != PRIM_TURN_LEFT && prim != PRIM_TURN_RIGHT;
+    double sec = extendsSegment ? moveSec[prim] * cells : commandSec(prim, cells, lastPrim);
+    return (int)lround(sec * 1000.0);
+}
+
+bool loadCostModel(const string& path, CostModel& model) {
+    ifstream in(path);
+    if (!in) {
+        return false;
+    }
+
+    string line;
+    while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        replace(line.begin(), line.end(), '=', ' ');
+        istringstream fields(line);
+        string key;
+        double value;
+        if (!(fields >> key)) continue;
+        if (!(fields >> value)) {
+            cout << "calibration: no value for " << key << "\n";
+            continue;
+        }
+
+        if (key == "forward")               model.moveSec[PRIM_FORWARD] = value;
+        else if (key == "backward")         model.moveSec[PRIM_BACKWARD] = value;
+        else if (key == "left")             model.moveSec[PRIM_LEFT] = value;
+        else if (key == "right")            model.moveSec[PRIM_RIGHT] = value;
+        else if (key == "turn") {
+            model.moveSec[PRIM_TURN_LEFT] = value;
+            model.moveSec[PRIM_TURN_RIGHT] = value;
+        }
+        else if (key == "stop")             model.stopSec = value;
+        else if (key == "direction_change") model.directionChangeSec = value;
+        else if (key == "pwm")              model.calibrationPwm = (int)value;
+        else if (key == "min_pwm") {
+            for (int p = PRIM_FORWARD; p <= PRIM_RIGHT; p++) model.minPwm[p] = (int)value;
+        }
+        else if (key == "min_pwm_turn") {
+            model.minPwm[PRIM_TURN_LEFT] = (int)value;
+            model.minPwm[PRIM_TURN_RIGHT] = (int)value;
+        }
+        else cout << "calibration: unknown key " << key << "\n";
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Track: no walls yet, only the grid border is closed
+Track::Track(int size) : gSize(size) {
+    int numCells = gSize * gSize;
+    verticalWalls.assign((numCells + 63) / 64, 0);
+    horizontalWalls.assign((numCells + 63) / 64, 0);
+
+    openDirs.assign(numCells, 0);
+    for (int y = 0; y < gSize; y++) {
+        for (int x = 0; x < gSize; x++) {
+            uint8_t open = 0;
+            if (y > 0)         open |= 1 << UP;
+            if (x < gSize - 1) open |= 1 << RIGHT;
+            if (y < gSize - 1) open |= 1 << DOWN;
+            if (x > 0)         open |= 1 << LEFT;
+            openDirs[y * gSize + x] = open;
+        }
+    }
+}
+
+bool Track::hasVerticalWall(int x, int y) const {
+    int bit = y * gSize + x;
+    return (verticalWalls[bit >> 6] >> (bit & 63)) & 1;
+}
+
+bool Track::hasHorizontalWall(int x, int y) const {
+    int bit = y * gSize + x;
+    return (horizontalWalls[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// Toggle the wall between (x, y) and (x+1, y) and fix both open masks
+void Track::toggleVerticalWall(int x, int y) {
+    int bit = y * gSize + x;
+    verticalWalls[bit >> 6] ^= uint64_t(1) << (bit & 63);
+    openDirs[bit]     ^= 1 << RIGHT;
+    openDirs[bit + 1] ^= 1 << LEFT;
+}
+
+// Toggle the wall between (x, y) and (x, y+1) and fix both open masks
+void Track::toggleHorizontalWall(int x, int y) {
+    int bit = y * gSize + x;
+    horizontalWalls[bit >> 6] ^= uint64_t(1) << (bit & 63);
+    openDirs[bit]         ^= 1 << DOWN;
+    openDirs[bit + gSize] ^= 1 << UP;
+}
+
+// Check if there's a wall between two adjacent cells
+bool Track::isWallBetween(int x1, int y1, int x2, int y2) const {
+    // Out of grid => treat as blocked
+    if (x1 < 0 || x1 >= gSize || y1 < 0 || y1 >= gSize) {
+        return true;
+    }
+
+    for (int d = 0; d < 4; d++) {
+        if (x1 + DIR_DX[d] == x2 && y1 + DIR_DY[d] == y2) {
+            return !((openDirs[y1 * gSize + x1] >> d) & 1);
+        }
+    }
+    // If not strictly adjacent in x or y, treat it as blocked:
+    return true;
+}
+
+namespace {
+
+// BFS tries neighbors in this order
+const int BFS_DIR_ORDER[4] = { UP, DOWN, LEFT, RIGHT };
+
+// -----------------------------------------------------------------------------
+// Reusable BFS scratch space so the planner doesn't hit the heap per search.
+// Visited is a generation stamp per cell: a new search bumps the generation
+// instead of clearing anything. The parent of each cell is the 2-bit direction
+// we arrived from (4 cells per byte), and the queue is a flat ring buffer.
+// Buffers only ever grow; the workspace allocation counter goes up each time
+// they do, so once warmed up it should stay flat between plans.
+struct BfsWorkspace {
+    vector<uint32_t> stamp;
+    vector<int> dist;
+    vector<uint8_t> parentDir;
+    vector<int> queue;
+    uint32_t generation = 0;
+    int queueMask = 0;
+
+    // returns how many buffers had to grow
+    int prepare(int numCells) {
+        int grew = 0;
+        if ((int)stamp.size() < numCells) {
+            stamp.assign(numCells, 0);
+            dist.resize(numCells);
+            parentDir.resize((numCells + 3) / 4);
+            generation = 0;
+            grew++;
+        }
+        int capacity = 1;
+        while (capacity < numCells) capacity <<= 1;
+        if ((int)queue.size() < capacity) {
+            queue.resize(capacity);
+            grew++;
+        }
+        queueMask = capacity - 1;
+
+        // stamps wrapped around, old marks could look current again
+        if (++generation == 0) {
+            fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+        return grew;
+    }
+
+    bool visited(int cell) const { return stamp[cell] == generation; }
+
+    int parentDirOf(int cell) const {
+        return (parentDir[cell >> 2] >> ((cell & 3) * 2)) & 3;
+    }
+
+    void setParentDir(int cell, int d) {
+        int shift = (cell & 3) * 2;
+        parentDir[cell >> 2] = (uint8_t)((parentDir[cell >> 2] & ~(3 << shift)) | (d << shift));
+    }
+
+    // same idea for the timed search over (cell, heading, last primitive)
+    vector<uint32_t> stateStamp;
+    vector<int> stateCost;
+    vector<int> stateParent;
+    vector<pair<int,int>> heap;
+    vector<pair<int,int>> seeds;
+    uint32_t stateGeneration = 0;
+
+    int prepareStates(int numStates) {
+        int grew = 0;
+        if ((int)stateStamp.size() < numStates) {
+            stateStamp.assign(numStates, 0);
+            stateCost.resize(numStates);
+            stateParent.resize(numStates);
+            heap.reserve(numStates);
+            stateGeneration = 0;
+            grew++;
+        }
+        if (++stateGeneration == 0) {
+            fill(stateStamp.begin(), stateStamp.end(), 0);
+            stateGeneration = 1;
+        }
+        return grew;
+    }
+
+    bool stateVisited(int st) const { return stateStamp[st] == stateGeneration; }
+};
+
+} // namespace
+
+// Workspaces are handed out to whichever thread is searching and given back
+// afterwards, so they survive between plans. One pool per Planner.
+struct Planner::WorkspacePool {
+    mutex lock;
+    vector<unique_ptr<BfsWorkspace>> free;
+};
+
+namespace {
+
+struct BfsWorkspaceLease {
+    Planner::WorkspacePool& pool;
+    unique_ptr<BfsWorkspace> ws;
+
+    explicit BfsWorkspaceLease(Planner::WorkspacePool& p) : pool(p) {
+        lock_guard<mutex> guard(pool.lock);
+        if (pool.free.empty()) {
+            ws = make_unique<BfsWorkspace>();
+        } else {
+            ws = move(pool.free.back());
+            pool.free.pop_back();
+        }
+    }
+
+    ~BfsWorkspaceLease() {
+        lock_guard<mutex> guard(pool.lock);
+        pool.free.push_back(move(ws));
+    }
+};
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Half-cell lattice for the robot's start and end points. (2x + 1, 2y + 1) is
+// the center of cell (x, y) and even coordinates lie on grid lines, so edge
+// and corner positions are lattice nodes like any other. Routes only pass
+// through cell centers; an edge or corner node is where the robot starts or
+// stops, joined to a center next to it by at most two half-steps.
+// -----------------------------------------------------------------------------
+
+// One way between the start or end point and a neighbouring cell center,
+// driven at a fixed heading. Steps are in driving order.
+struct LatticeLeg {
+    int cell;
+    int heading;
+    PartialSteps steps;
+};
+
+// a corner node: along any of the 4 lines, then off either side
+const int MAX_LATTICE_PATHS = 8;
+
+// fixed size so a PlanContext stays off the heap; end legs come in 4 headings
+struct LatticeLegs {
+    int count = 0;
+    LatticeLeg legs[4 * MAX_LATTICE_PATHS];
+
+    void push_back(const LatticeLeg& leg) { legs[count++] = leg; }
+    bool empty() const { return count == 0; }
+    int size() const { return count; }
+    const LatticeLeg& operator[](int i) const { return legs[i]; }
+    const LatticeLeg* begin() const { return legs; }
+    const LatticeLeg* end() const { return legs + count; }
+};
+
+namespace {
+
+int latticeX(const RobotState& s) { return 2 * s.gridX + 1 + POSITION_DX[s.positionType]; }
+int latticeY(const RobotState& s) { return 2 * s.gridY + 1 + POSITION_DY[s.positionType]; }
+
+// A half-step from node (hx, hy). It must stay on the grid; across a cell it
+// must not leave or reach a grid line where a wall stands, along a grid line
+// it must not run along a wall. The border has no wall bits, the robot may
+// drive along it.
+bool halfStepOpen(const Track& track, int hx, int hy, int dir) {
+    int nx = hx + DIR_DX[dir];
+    int ny = hy + DIR_DY[dir];
+    if (nx < 0 || nx > 2 * track.gSize || ny < 0 || ny > 2 * track.gSize) {
+        return false;
+    }
+    bool horizontal = dir == LEFT || dir == RIGHT;
+    int line = horizontal ? hy : hx;
+    if (line & 1) {
+        // one end of the step sits on the crossed grid line
+        int cross = horizontal ? (hx & 1 ? nx : hx) / 2 : (hy & 1 ? ny : hy) / 2;
+        if (cross == 0 || cross == track.gSize) {
+            return true;
+        }
+        line /= 2;
+        return horizontal ? !track.hasVerticalWall(cross - 1, line) : !track.hasHorizontalWall(line, cross - 1);
+    }
+    line /= 2;
+    if (line == 0 || line == track.gSize) {
+        return true;
+    }
+    int along = min(horizontal ? hx : hy, horizontal ? nx : ny) / 2;
+    return horizontal ? !track.hasHorizontalWall(along, line - 1) : !track.hasVerticalWall(line - 1, along);
+}
+
+// Lattice paths from node (hx, hy) to every cell center it can reach without
+// passing through another center: none from a center, straight off the line
+// from an edge, along a line and then off it from a corner.
+struct LatticePath {
+    int cell;
+    int count;
+    int dirs[2];
+};
+
+int latticePaths(const Track& track, int hx, int hy, LatticePath paths[MAX_LATTICE_PATHS]) {
+    const int g = track.gSize;
+    int count = 0;
+    auto isCenter = [g](int x, int y) { return (x & 1) && (y & 1) && x > 0 && x < 2 * g && y > 0 && y < 2 * g; };
+    if (isCenter(hx, hy)) {
+        paths[count++] = { (hy / 2) * g + hx / 2, 0, { 0, 0 } };
+        return count;
+    }
+
+    for (int d = 0; d < 4; d++) {
+        if (!halfStepOpen(track, hx, hy, d)) continue;
+        int mx = hx + DIR_DX[d];
+        int my = hy + DIR_DY[d];
+        if (isCenter(mx, my)) {
+            paths[count++] = { (my / 2) * g + mx / 2, 1, { d, 0 } };
+            continue;
+        }
+        if ((hx & 1) || (hy & 1)) continue;  // edge nodes only go straight off the line
+
+        for (int d2 : { (d + 1) % 4, (d + 3) % 4 }) {
+            int cx = mx + DIR_DX[d2];
+            int cy = my + DIR_DY[d2];
+            if (isCenter(cx, cy)) {
+                paths[count++] = { (cy / 2) * g + cx / 2, 2, { d, d2 } };
+            }
+        }
+    }
+    return count;
+}
+
+// the path as half-steps for a robot facing `heading`, walked backwards for
+// the end point (center -> node)
+PartialSteps latticeSteps(const LatticePath& path, int heading, bool reversed) {
+    PartialSteps steps{};
+    for (int i = 0; i < path.count; i++) {
+        int dir = reversed ? (path.dirs[path.count - 1 - i] + 2) % 4 : path.dirs[i];
+        steps.steps[steps.count++] = motion(movePrim(heading, dir), HALF_CELL);
+    }
+    return steps;
+}
+
+// Every legal way off the start point at the start heading, and onto the end
+// point at any heading the robot can finish with.
+void findLatticeLegs(const Track& track, const PlannerOptions& opt,
+                     LatticeLegs& startLegs, LatticeLegs& endLegs) {
+    const RobotState& start = track.robotStartState;
+    const RobotState& end = track.robotEndState;
+    LatticePath paths[MAX_LATTICE_PATHS];
+
+    if (start.valid) {
+        int count = latticePaths(track, latticeX(start), latticeY(start), paths);
+        for (int i = 0; i < count; i++) {
+            startLegs.push_back({ paths[i].cell, start.orientation, latticeSteps(paths[i], start.orientation, false) });
+        }
+    }
+    if (end.valid) {
+        int count = latticePaths(track, latticeX(end), latticeY(end), paths);
+        for (int h = 0; h < 4; h++) {
+            if (!opt.allowTurns && h != start.orientation) continue;
+            for (int i = 0; i < count; i++) {
+                endLegs.push_back({ paths[i].cell, h, latticeSteps(paths[i], h, true) });
+            }
+        }
+    }
+}
+
+} // namespace
+
+// Everything one planner call needs, passed around instead of globals.
+struct PlanContext {
+    const Track& track;
+    const PlannerOptions& opt;
+    Planner::WorkspacePool& pool;
+    int gSize;
+    atomic<long long> bfsRuns{0};
+    atomic<long long> workspaceAllocations{0};
+    atomic<long long> nodesExpanded{0};  // cells / states taken off a queue
+    PlanProgress* progress = nullptr;
+    LatticeLegs startLegs;               // start point -> a cell center
+    LatticeLegs endLegs;                 // a cell center -> robot end point
+    // the winning tour as rerankByTourTime() drove it (see planTimedTour),
+    // so tourCommands() doesn't have to drive it again
+    vector<pair<int,int>> tourWaypoints;
+    vector<int> tourStates;
+    int tourEndLeg = -1;
+
+    PlanContext(const Track& t, const PlannerOptions& o, Planner::WorkspacePool& p,
+                PlanProgress* pr = nullptr)
+        : track(t), opt(o), pool(p), gSize(t.gSize), progress(pr) {
+        findLatticeLegs(track, opt, startLegs, endLegs);
+    }
+
+    bool cancelled() const { return progress && progress->cancel.load(memory_order_relaxed); }
+};
+
+namespace {
+
+// BFS from startCell using grid.openDirs. Stops once goalCell is reached,
+// pass -1 to flood the whole grid. Afterwards ws.dist/parent are valid for
+// every cell with ws.visited(cell).
+void runBfs(PlanContext& ctx, BfsWorkspace& ws, int startCell, int goalCell) {
+    const int gSize = ctx.gSize;
+    const int step[4] = { -gSize, 1, gSize, -1 };
+    ctx.workspaceAllocations += ws.prepare(gSize * gSize);
+    ctx.bfsRuns++;
+
+    int head = 0;
+    int tail = 0;
+    ws.queue[tail++ & ws.queueMask] = startCell;
+    ws.stamp[startCell] = ws.generation;
+    ws.dist[startCell] = 0;
+
+    while (head != tail) {
+        int cur = ws.queue[head++ & ws.queueMask];
+        if (cur == goalCell) {
+            break;
+        }
+
+        uint8_t open = ctx.track.openDirs[cur];
+        for (int d : BFS_DIR_ORDER) {
+            if (!((open >> d) & 1)) continue;
+            int next = cur + step[d];
+            if (!ws.visited(next)) {
+                ws.stamp[next] = ws.generation;
+                ws.dist[next] = ws.dist[cur] + 1;
+                ws.setParentDir(next, d);
+                ws.queue[tail++ & ws.queueMask] = next;
+            }
+        }
+    }
+    ctx.nodesExpanded += head;
+}
+
+// -----------------------------------------------------------------------------
+// Timed search states: (cell, heading, last primitive) packed into one int.
+const int PRIM_SLOTS = NUM_PRIMITIVES + 1;
+const int STATES_PER_CELL = 4 * PRIM_SLOTS;
+
+int packState(int cell, int heading, int lastPrim) {
+    return (cell * 4 + heading) * PRIM_SLOTS + lastPrim;
+}
+int stateCell(int st)     { return st / STATES_PER_CELL; }
+int stateHeading(int st)  { return (st / PRIM_SLOTS) % 4; }
+int stateLastPrim(int st) { return st % PRIM_SLOTS; }
+
+// Calls fn(next state, step ms) for every primitive the robot can do from st.
+// Turns are only tried when `turns` is set.
+template <class Fn>
+void forEachSuccessor(const PlanContext& ctx, int st, bool turns, Fn fn) {
+    const int step[4] = { -ctx.gSize, 1, ctx.gSize, -1 };
+    int cell = stateCell(st);
+    int heading = stateHeading(st);
+    int lastPrim = stateLastPrim(st);
+    uint8_t open = ctx.track.openDirs[cell];
+
+    for (int p = 0; p < NUM_PRIMITIVES; p++) {
+        int nextCell = cell;
+        int nextHeading = heading;
+        if (p == PRIM_TURN_LEFT || p == PRIM_TURN_RIGHT) {
+            if (!turns) continue;
+            nextHeading = (p == PRIM_TURN_LEFT) ? (heading + 3) % 4 : (heading + 1) % 4;
+        } else {
+            int dir = moveDir(heading, p);
+            if (!((open >> dir) & 1)) continue;
+            nextCell = cell + step[dir];
+        }
+        fn(packState(nextCell, nextHeading, p), ctx.opt.costModel.stepMs(p, lastPrim, ctx.opt.coalesceMoves));
+    }
+}
+
+// The reverse: fn(previous state, step ms) for every state with a move into st.
+template <class Fn>
+void forEachPredecessor(const PlanContext& ctx, int st, bool turns, Fn fn) {
+    const int step[4] = { -ctx.gSize, 1, ctx.gSize, -1 };
+    int cell = stateCell(st);
+    int heading = stateHeading(st);
+    int p = stateLastPrim(st);
+    if (p == NO_PRIM) return;  // only seeds have no last move
+
+    int prevCell = cell;
+    int prevHeading = heading;
+    if (p == PRIM_TURN_LEFT || p == PRIM_TURN_RIGHT) {
+        if (!turns) return;
+        prevHeading = (p == PRIM_TURN_LEFT) ? (heading + 1) % 4 : (heading + 3) % 4;
+    } else {
+        int dir = moveDir(heading, p);
+        if (!((ctx.track.openDirs[cell] >> ((dir + 2) % 4)) & 1)) return;
+        prevCell = cell - step[dir];
+    }
+    for (int last = 0; last < PRIM_SLOTS; last++) {
+        fn(packState(prevCell, prevHeading, last), ctx.opt.costModel.stepMs(p, last, ctx.opt.coalesceMoves));
+    }
+}
+
+// Dijkstra in milliseconds under the cost model, starting from every (state, cost)
+// in seeds. The last primitive is part of the state so direction changes can
+// be charged. Turns are only tried when `turns` is set; otherwise the heading
+// never changes and moves are named relative to it. With a goalCell it stops
+// once every state up to slackMs past the first arrival there is settled
+// (-1 settles everything). Afterwards ws.stateCost and ws.stateParent are
+// valid for every ws.stateVisited(st); past the stop the costs are only
+// upper bounds.
+void runTimedSearch(PlanContext& ctx, BfsWorkspace& ws, const vector<pair<int,int>>& seeds,
+                    bool turns, int goalCell, int slackMs = 0) {
+    const int gSize = ctx.gSize;
+    auto later = [](const pair<int,int>& a, const pair<int,int>& b) { return a.first > b.first; };
+
+    ctx.workspaceAllocations += ws.prepareStates(gSize * gSize * STATES_PER_CELL);
+    size_t heapCapacity = ws.heap.capacity();
+    ws.heap.clear();
+    ctx.bfsRuns++;
+
+    for (auto [st, c] : seeds) {
+        if (ws.stateVisited(st) && ws.stateCost[st] <= c) continue;
+        ws.stateStamp[st] = ws.stateGeneration;
+        ws.stateCost[st] = c;
+        ws.stateParent[st] = -1;
+        ws.heap.push_back({c, st});
+        push_heap(ws.heap.begin(), ws.heap.end(), later);
+    }
+
+    long long expanded = 0;
+    int stopAbove = numeric_limits<int>::max();
+    while (!ws.heap.empty()) {
+        pop_heap(ws.heap.begin(), ws.heap.end(), later);
+        auto [c, st] = ws.heap.back();
+        ws.heap.pop_back();
+        if (c > ws.stateCost[st]) continue;
+        if (c > stopAbove) break;
+        expanded++;
+        if (stateCell(st) == goalCell && stopAbove == numeric_limits<int>::max()) stopAbove = c + slackMs;
+        if ((expanded & 1023) == 0 && ctx.cancelled()) break;
+
+        forEachSuccessor(ctx, st, turns, [&, c = c, st = st](int next, int stepMs) {
+            int nc = c + stepMs;
+            if (!ws.stateVisited(next) || nc < ws.stateCost[next]) {
+                ws.stateStamp[next] = ws.stateGeneration;
+                ws.stateCost[next] = nc;
+                ws.stateParent[next] = st;
+                ws.heap.push_back({nc, next});
+                push_heap(ws.heap.begin(), ws.heap.end(), later);
+            }
+        });
+    }
+
+    if (ws.heap.capacity() != heapCapacity) {
+        ctx.workspaceAllocations++;
+    }
+    ctx.nodesExpanded += expanded;
+}
+
+// Cheapest settled state anywhere in `cell`, or -1
+int bestStateInCell(const BfsWorkspace& ws, int cell) {
+    int best = -1;
+    for (int st = cell * STATES_PER_CELL; st < (cell + 1) * STATES_PER_CELL; st++) {
+        if (ws.stateVisited(st) && (best == -1 || ws.stateCost[st] < ws.stateCost[best])) {
+            best = st;
+        }
+    }
+    return best;
+}
+
+// Half-steps of a lattice leg in ms, driven right after lastPrim
+int latticeLegMs(const PlanContext& ctx, const LatticeLeg& leg, int lastPrim) {
+    int ms = 0;
+    for (int i = 0; i < leg.steps.count; i++) {
+        int prim = leg.steps.steps[i].prim;
+        ms += ctx.opt.costModel.stepMs(prim, lastPrim, ctx.opt.coalesceMoves, 0.5);
+        lastPrim = prim;
+    }
+    return ms;
+}
+
+// the state a start leg leaves the robot in at its cell center
+int startLegState(const LatticeLeg& leg) {
+    int lastPrim = leg.steps.count > 0 ? leg.steps.steps[leg.steps.count - 1].prim : NO_PRIM;
+    return packState(leg.cell, leg.heading, lastPrim);
+}
+
+// Where a search leaving point (x, y) may start. The robot start is every
+// center its start legs reach, already paying for the half-steps; at a
+// checkpoint the heading depends on the previous leg, so with turns allowed
+// any heading is fair game.
+void legSeeds(const PlanContext& ctx, pair<int,int> from, bool isStart, vector<pair<int,int>>& seeds) {
+    int cell = from.second * ctx.gSize + from.first;
+    seeds.clear();
+    if (isStart) {
+        for (const LatticeLeg& leg : ctx.startLegs) {
+            seeds.push_back({ startLegState(leg), latticeLegMs(ctx, leg, NO_PRIM) });
+        }
+    } else if (!ctx.opt.allowTurns) {
+        seeds.push_back({packState(cell, ctx.track.robotStartState.orientation, NO_PRIM), 0});
+    } else {
+        for (int h = 0; h < 4; h++) {
+            seeds.push_back({packState(cell, h, NO_PRIM), 0});
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BFS (center-to-center) ignoring orientation
+vector<pair<int,int>> shortestPathBetween(PlanContext& ctx, pair<int,int> start, pair<int,int> goal) {
+    if (start == goal) {
+        return { start };
+    }
+
+    const int gSize = ctx.gSize;
+    int startCell = start.second * gSize + start.first;
+    int goalCell = goal.second * gSize + goal.first;
+    const int step[4] = { -gSize, 1, gSize, -1 };
+
+    BfsWorkspaceLease lease(ctx.pool);
+    BfsWorkspace& ws = *lease.ws;
+    runBfs(ctx, ws, startCell, goalCell);
+
+    if (!ws.visited(goalCell)) {
+        return {};
+    }
+
+    // Reconstruct path by stepping back against the stored directions
+    vector<pair<int,int>> path(ws.dist[goalCell] + 1);
+    int cur = goalCell;
+    for (int i = (int)path.size() - 1; i >= 0; i--) {
+        path[i] = {cur % gSize, cur / gSize};
+        if (i > 0) {
+            cur -= step[ws.parentDirOf(cur)];
+        }
+    }
+    return path;
+}
+
+
+// -----------------------------------------------------------------------------
+// Run fn(i) for every i in [0, count), split into chunks across the cores.
+// Small jobs just run on the calling thread.
+void parallelFor(size_t count, const function<void(size_t)>& fn, size_t minPerThread = 256) {
+    size_t numThreads = max(1u, thread::hardware_concurrency());
+    numThreads = min(numThreads, (count + minPerThread - 1) / minPerThread);
+
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    vector<thread> workers;
+    size_t chunk = (count + numThreads - 1) / numThreads;
+    for (size_t t = 0; t < numThreads; t++) {
+        size_t begin = t * chunk;
+        size_t end = min(count, begin + chunk);
+        workers.emplace_back([begin, end, &fn]() {
+            for (size_t i = begin; i < end; i++) {
+                fn(i);
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Predicted leg times (ms) between every pair of points of interest, built once
+// per Find Path click. Not symmetric: backward can be slower than forward.
+// Points are laid out as:
+//   0..n-1 = normal checkpoints, n = start, n+1 = end checkpoint, n+2 = robot end
+// so checkpoint i is bit i in the Held-Karp masks.
+const int UNREACHABLE = numeric_limits<int>::max() / 4;
+
+struct DistanceMatrix {
+    int numCheckpoints = 0;
+    vector<pair<int,int>> points;
+    vector<int> dist;              // points.size() x points.size(), milliseconds
+
+    int start() const { return numCheckpoints; }
+    int endCheckpoint() const { return numCheckpoints + 1; }
+    int robotEnd() const { return numCheckpoints + 2; }
+    int at(int a, int b) const { return dist[a * points.size() + b]; }
+};
+
+// Cheapest way to finish on the robot end point: arrival cost(st) at a center
+// (UNREACHABLE if never reached) plus the half-steps of an end leg from there.
+// The winning arrival state and end leg go to bestState / bestLeg.
+template <class CostFn>
+int bestEndArrival(const PlanContext& ctx, CostFn cost, int* bestState = nullptr, int* bestLeg = nullptr) {
+    int best = UNREACHABLE;
+    for (int i = 0; i < ctx.endLegs.size(); i++) {
+        const LatticeLeg& leg = ctx.endLegs[i];
+        for (int last = 0; last < PRIM_SLOTS; last++) {
+            int st = packState(leg.cell, leg.heading, last);
+            int c = cost(st);
+            if (c >= UNREACHABLE) continue;
+            c += latticeLegMs(ctx, leg, last);
+            if (c < best) {
+                best = c;
+                if (bestState) *bestState = st;
+                if (bestLeg) *bestLeg = i;
+            }
+        }
+    }
+    return best;
+}
+
+// One timed search per point of interest (in parallel), then read off the pair times.
+DistanceMatrix buildDistanceMatrix(PlanContext& ctx, const vector<pair<int,int>>& cpts) {
+    const Track& track = ctx.track;
+    DistanceMatrix dm;
+    dm.numCheckpoints = (int)cpts.size();
+    dm.points = cpts;
+    dm.points.push_back({track.robotStartState.gridX, track.robotStartState.gridY});
+    dm.points.push_back(track.endCheckpoint);
+    dm.points.push_back({track.robotEndState.gridX, track.robotEndState.gridY});
+
+    int numPts = (int)dm.points.size();
+    dm.dist.assign(numPts * numPts, UNREACHABLE);
+    if (ctx.progress) {
+        ctx.progress->legsTotal = numPts;
+    }
+
+    parallelFor(numPts, [&](size_t a) {
+        BfsWorkspaceLease lease(ctx.pool);
+        BfsWorkspace& ws = *lease.ws;
+        legSeeds(ctx, dm.points[a], (int)a == dm.start(), ws.seeds);
+        runTimedSearch(ctx, ws, ws.seeds, ctx.opt.allowTurns, -1);
+
+        for (int b = 0; b < numPts; b++) {
+            if (b == dm.robotEnd()) {
+                dm.dist[a * numPts + b] = bestEndArrival(ctx, [&ws](int st) {
+                    return ws.stateVisited(st) ? ws.stateCost[st] : UNREACHABLE;
+                });
+                continue;
+            }
+            auto [bx, by] = dm.points[b];
+            int st = bestStateInCell(ws, by * ctx.gSize + bx);
+            if (st != -1) {
+                dm.dist[a * numPts + b] = ws.stateCost[st];
+            }
+        }
+        if (ctx.progress) {
+            ctx.progress->legsSearched++;
+        }
+    }, 1);
+    return dm;
+}
+
+// Total distance of start -> order[0] -> ... (order ends with end checkpoint, robot end)
+int tourCost(const DistanceMatrix& dm, const vector<int>& order) {
+    int total = 0;
+    int prev = dm.start();
+    for (int idx : order) {
+        int leg = dm.at(prev, idx);
+        if (leg >= UNREACHABLE) return UNREACHABLE;
+        total += leg;
+        prev = idx;
+    }
+    return total;
+}
+
+// How much dearer than the cheapest arrival at a cell another arrival there
+// can be and still matter: the cheapest one can turn to the other's heading
+// (two turns at most) and drive on the same way, paying at worst the stop the
+// other's first move skipped. Without turns every state keeps the start
+// heading, so only the stop is left.
+int arrivalSlackMs(const PlanContext& ctx, bool turns) {
+    const CostModel& model = ctx.opt.costModel;
+    bool coalesce = ctx.opt.coalesceMoves;
+    int turnMs = 0;
+    int stopMs = 0;
+    for (int last = 0; last < PRIM_SLOTS; last++) {
+        turnMs = max(turnMs, model.stepMs(PRIM_TURN_LEFT, last, coalesce));
+        turnMs = max(turnMs, model.stepMs(PRIM_TURN_RIGHT, last, coalesce));
+        for (int p = 0; p < NUM_PRIMITIVES; p++) {
+            for (int other = 0; other < PRIM_SLOTS; other++) {
+                for (double cells : { 1.0, 0.5 }) {
+                    stopMs = max(stopMs, model.stepMs(p, last, coalesce, cells) - model.stepMs(p, other, coalesce, cells));
+                }
+            }
+        }
+    }
+    return turns ? 2 * turnMs + stopMs : stopMs;
+}
+
+// Plans start -> waypoints[1] -> ... -> robot end as a chain of timed
+// searches. Each leg is seeded with every state it could have arrived at the
+// previous waypoint in (heading and last primitive included), so the result
+// is exact for that visiting order; the first leg starts from the start legs
+// and the last one finishes through the cheapest end leg. A leg stops
+// arrivalSlackMs() past its first arrival, nothing later can win. Fills
+// the visited states (states[0] = where a start leg left the robot) and that
+// end leg, returns the tour's ms (UNREACHABLE if there is none).
+int planTimedTour(PlanContext& ctx, const vector<pair<int,int>>& waypoints, bool turns,
+                  vector<int>& states, int& endLeg) {
+    const int gSize = ctx.gSize;
+    int numLegs = (int)waypoints.size() - 1;
+    BfsWorkspaceLease lease(ctx.pool);
+    BfsWorkspace& ws = *lease.ws;
+
+    vector<pair<int,int>> seeds;
+    legSeeds(ctx, waypoints[0], true, seeds);
+    vector<vector<int>> legParent(numLegs);
+    int slackMs = arrivalSlackMs(ctx, turns);
+
+    for (int leg = 0; leg < numLegs; leg++) {
+        // the last leg ends through the end legs, it settles everything
+        auto [tx, ty] = waypoints[leg + 1];
+        int goalCell = leg < numLegs - 1 ? ty * gSize + tx : -1;
+        runTimedSearch(ctx, ws, seeds, turns, goalCell, slackMs);
+        legParent[leg] = ws.stateParent;
+        if (leg == numLegs - 1) break;
+
+        // next leg carries on from any way we could have arrived here
+        int target = ty * gSize + tx;
+        seeds.clear();
+        for (int st = target * STATES_PER_CELL; st < (target + 1) * STATES_PER_CELL; st++) {
+            if (ws.stateVisited(st)) seeds.push_back({st, ws.stateCost[st]});
+        }
+        if (seeds.empty()) {
+            return UNREACHABLE;
+        }
+    }
+
+    // cheapest way onto the robot end point, then walk back leg by leg
+    int st = -1;
+    int arrival = bestEndArrival(ctx, [&ws](int s) {
+        return ws.stateVisited(s) ? ws.stateCost[s] : UNREACHABLE;
+    }, &st, &endLeg);
+    if (arrival >= UNREACHABLE) {
+        return UNREACHABLE;
+    }
+
+    states.clear();
+    for (int leg = numLegs - 1; leg >= 0; leg--) {
+        while (legParent[leg][st] != -1) {
+            states.push_back(st);
+            st = legParent[leg][st];
+        }
+    }
+    states.push_back(st);
+    reverse(states.begin(), states.end());
+    return arrival;
+}
+
+vector<pair<int,int>> waypointsFor(const DistanceMatrix& dm, const vector<int>& order) {
+    vector<pair<int,int>> waypoints = { dm.points[dm.start()] };
+    for (int idx : order) {
+        waypoints.push_back(dm.points[idx]);
+    }
+    return waypoints;
+}
+
+// tell whoever is watching about a better order
+void reportTour(PlanContext& ctx, const DistanceMatrix& dm, const vector<int>& order, int cost) {
+    if (!ctx.progress || order.empty() || cost >= UNREACHABLE) {
+        return;
+    }
+    ctx.progress->bestTourMs = cost;
+    if (ctx.progress->onBetterTour) {
+        ctx.progress->onBetterTour(waypointsFor(dm, order), cost / 1000.0);
+    }
+}
+
+// The cells a tour's states drive through, each once per visit
+vector<pair<int,int>> statesPath(const PlanContext& ctx, const vector<int>& states) {
+    vector<pair<int,int>> path;
+    for (int st : states) {
+        int cell = stateCell(st);
+        pair<int,int> xy = { cell % ctx.gSize, cell / ctx.gSize };
+        if (path.empty() || path.back() != xy) {
+            path.push_back(xy);
+        }
+    }
+    return path;
+}
+
+// Rebuild the cell path for the winning order only, keeping the start heading.
+vector<pair<int,int>> tourPath(PlanContext& ctx, const vector<pair<int,int>>& waypoints) {
+    vector<int> states;
+    int endLeg;
+    if (waypoints.empty() || planTimedTour(ctx, waypoints, false, states, endLeg) >= UNREACHABLE) {
+        return {};
+    }
+    return statesPath(ctx, states);
+}
+
+// -----------------------------------------------------------------------------
+// Held-Karp: dp[mask][j] = shortest start -> (every checkpoint in mask) -> j.
+// Same rule as the permutation loop: after all normal checkpoints go to the
+// end checkpoint, then to the robot end. O(2^n * n^2) on the distance matrix.
+// Each popcount layer only reads the layer below it, so a layer is split
+// across threads.
+vector<int> heldKarpOrder(const PlanContext& ctx, const DistanceMatrix& dm) {
+    const int n = dm.numCheckpoints;
+
+    size_t numMasks = size_t(1) << n;
+    vector<int> dp(numMasks * n, UNREACHABLE);
+    vector<signed char> parent(numMasks * n, -1);
+
+    for (int j = 0; j < n; j++) {
+        dp[(size_t(1) << j) * n + j] = dm.at(dm.start(), j);
+    }
+
+    // group masks by how many checkpoints they contain
+    vector<vector<uint32_t>> layers(n + 1);
+    for (size_t mask = 1; mask < numMasks; mask++) {
+        layers[__builtin_popcount((unsigned)mask)].push_back((uint32_t)mask);
+    }
+
+    for (int k = 2; k <= n; k++) {
+        if (ctx.cancelled()) {
+            return {};
+        }
+        const vector<uint32_t>& layer = layers[k];
+        parallelFor(layer.size(), [&](size_t idx) {
+            size_t mask = layer[idx];
+            for (int j = 0; j < n; j++) {
+                if (!(mask & (size_t(1) << j))) continue;
+                size_t prevMask = mask ^ (size_t(1) << j);
+                int bestCost = UNREACHABLE;
+                int bestPrev = -1;
+                for (int i = 0; i < n; i++) {
+                    if (!(prevMask & (size_t(1) << i))) continue;
+                    int c = dp[prevMask * n + i] + dm.at(i, j);
+                    if (c < bestCost) {
+                        bestCost = c;
+                        bestPrev = i;
+                    }
+                }
+                dp[mask * n + j] = bestCost;
+                parent[mask * n + j] = (signed char)bestPrev;
+            }
+        });
+    }
+
+    // pick the best last checkpoint before heading to the end checkpoint
+    size_t fullMask = numMasks - 1;
+    int bestCost = UNREACHABLE;
+    int last = -1;
+    for (int j = 0; j < n; j++) {
+        int c = dp[fullMask * n + j] + dm.at(j, dm.endCheckpoint());
+        if (c < bestCost) {
+            bestCost = c;
+            last = j;
+        }
+    }
+    if (last == -1) {
+        return {};
+    }
+
+    // walk the parents back to get the checkpoint order
+    vector<int> order;
+    size_t mask = fullMask;
+    for (int j = last; j != -1; ) {
+        order.push_back(j);
+        int prev = parent[mask * n + j];
+        mask ^= size_t(1) << j;
+        j = prev;
+    }
+    reverse(order.begin(), order.end());
+    order.push_back(dm.endCheckpoint());
+    order.push_back(dm.robotEnd());
+    return order;
+}
+
+// -----------------------------------------------------------------------------
+// Anytime branch-and-bound for layouts past Held-Karp range. A nearest-neighbour
+// tour gives an answer right away, then a DFS over orderings (closest checkpoint
+// first) keeps improving it until the time budget runs out. A partial order is
+// cut when cost so far + MST over {current, unvisited, end checkpoint} +
+// (end checkpoint -> robot end) can't beat the best tour. Any way of finishing
+// is a spanning path of that set, so the bound never overestimates.
+struct BranchAndBound {
+    PlanContext& ctx;
+    const DistanceMatrix& dm;
+    chrono::steady_clock::time_point deadline;
+
+    vector<int> bestOrder;
+    long long bestCost = UNREACHABLE;
+
+    vector<int> current;
+    vector<char> visited;
+    long long nodes = 0;
+    bool timedOut = false;
+
+    // scratch, so a search node doesn't allocate: candidates per depth and
+    // remainingBound()'s MST
+    vector<vector<int>> nextByDepth;
+    vector<int> nodesLeft;
+    vector<long long> key;
+    vector<char> inTree;
+
+    BranchAndBound(PlanContext& c, const DistanceMatrix& matrix, int budgetMs)
+        : ctx(c), dm(matrix),
+          deadline(chrono::steady_clock::now() + chrono::milliseconds(budgetMs)),
+          visited(matrix.numCheckpoints, 0), nextByDepth(matrix.numCheckpoints) {
+        int k = matrix.numCheckpoints + 2;
+        current.reserve(k);
+        for (vector<int>& next : nextByDepth) next.reserve(k);
+        nodesLeft.reserve(k);
+        key.reserve(k);
+        inTree.reserve(k);
+    }
+
+    // Prim's MST over `from`, the unvisited checkpoints and the end checkpoint
+    long long remainingBound(int from) {
+        nodesLeft.assign(1, from);
+        for (int i = 0; i < dm.numCheckpoints; i++) {
+            if (!visited[i]) nodesLeft.push_back(i);
+        }
+        nodesLeft.push_back(dm.endCheckpoint());
+
+        int k = (int)nodesLeft.size();
+        key.assign(k, numeric_limits<long long>::max());
+        inTree.assign(k, 0);
+        key[0] = 0;
+        long long total = 0;
+        for (int step = 0; step < k; step++) {
+            int u = -1;
+            for (int i = 0; i < k; i++) {
+                if (!inTree[i] && (u == -1 || key[i] < key[u])) u = i;
+            }
+            inTree[u] = 1;
+            total += key[u];
+            for (int v = 0; v < k; v++) {
+                if (!inTree[v]) {
+                    // times aren't symmetric, the cheaper direction keeps the bound admissible
+                    int edge = min(dm.at(nodesLeft[u], nodesLeft[v]), dm.at(nodesLeft[v], nodesLeft[u]));
+                    key[v] = min(key[v], (long long)edge);
+                }
+            }
+        }
+        return total + dm.at(dm.endCheckpoint(), dm.robotEnd());
+    }
+
+    void finishTour(long long cost) {
+        int last = current.empty() ? dm.start() : current.back();
+        cost += dm.at(last, dm.endCheckpoint()) + dm.at(dm.endCheckpoint(), dm.robotEnd());
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestOrder = current;
+            bestOrder.push_back(dm.endCheckpoint());
+            bestOrder.push_back(dm.robotEnd());
+            reportTour(ctx, dm, bestOrder, (int)bestCost);
+        }
+    }
+
+    void nearestNeighbourTour() {
+        long long cost = 0;
+        int last = dm.start();
+        for (int step = 0; step < dm.numCheckpoints; step++) {
+            int next = -1;
+            for (int i = 0; i < dm.numCheckpoints; i++) {
+                if (!visited[i] && (next == -1 || dm.at(last, i) < dm.at(last, next))) next = i;
+            }
+            cost += dm.at(last, next);
+            visited[next] = 1;
+            current.push_back(next);
+            last = next;
+        }
+        finishTour(cost);
+
+        current.clear();
+        fill(visited.begin(), visited.end(), 0);
+    }
+
+    void search(long long cost) {
+        if (timedOut) return;
+        if ((++nodes & 1023) == 0 && (chrono::steady_clock::now() > deadline || ctx.cancelled())) {
+            timedOut = true;
+            return;
+        }
+
+        if ((int)current.size() == dm.numCheckpoints) {
+            finishTour(cost);
+            return;
+        }
+
+        int last = current.empty() ? dm.start() : current.back();
+        if (cost + remainingBound(last) >= bestCost) return;
+
+        // try the closest checkpoints first so good tours show up early
+        vector<int>& next = nextByDepth[current.size()];
+        next.clear();
+        for (int i = 0; i < dm.numCheckpoints; i++) {
+            if (!visited[i]) next.push_back(i);
+        }
+        sort(next.begin(), next.end(), [&](int a, int b) {
+            return dm.at(last, a) < dm.at(last, b);
+        });
+
+        for (int i : next) {
+            long long legCost = cost + dm.at(last, i);
+            if (legCost >= bestCost) break;
+            visited[i] = 1;
+            current.push_back(i);
+            search(legCost);
+            current.pop_back();
+            visited[i] = 0;
+        }
+    }
+};
+
+// Fills bestOrder with the best tour found in the time budget. Returns true if
+// the search finished, i.e. that tour is proven optimal.
+bool branchAndBoundOrder(PlanContext& ctx, const DistanceMatrix& dm, int budgetMs, vector<int>& bestOrder) {
+    BranchAndBound bb(ctx, dm, budgetMs);
+    bb.nearestNeighbourTour();
+    bb.search(0);
+    bestOrder = bb.bestOrder;
+    return !bb.timedOut;
+}
+
+// -----------------------------------------------------------------------------
+// Local search for big practice fields (30-100 checkpoints) where even
+// branch-and-bound can't get close. The tour is kept as
+//   seq[0] = start, seq[1..n] = checkpoints, seq[n+1] = end checkpoint
+// so start and end checkpoint never move (robot end always comes after).
+// Improves with 2-opt (reverse a stretch) and Or-opt (move a run of 1-3
+// checkpoints, maybe flipped) until nothing helps. Leg times aren't symmetric,
+// so a flipped stretch also pays for driving its inside legs the other way.
+const int LOCAL_SEARCH_RESTARTS = 32;
+
+long long seqCost(const DistanceMatrix& dm, const vector<int>& seq) {
+    long long total = 0;
+    for (size_t i = 0; i + 1 < seq.size(); i++) {
+        total += dm.at(seq[i], seq[i+1]);
+    }
+    return total;
+}
+
+// Nearest-neighbour start, but each step picks randomly among the few closest
+// (restart 0 is plain nearest-neighbour).
+vector<int> randomizedNearestNeighbour(const DistanceMatrix& dm, mt19937& rng, int choices) {
+    int n = dm.numCheckpoints;
+    vector<int> seq = { dm.start() };
+    vector<char> used(n, 0);
+    vector<int> cand;
+    for (int step = 0; step < n; step++) {
+        int last = seq.back();
+        cand.clear();
+        for (int i = 0; i < n; i++) {
+            if (!used[i]) cand.push_back(i);
+        }
+        int k = min((int)cand.size(), choices);
+        partial_sort(cand.begin(), cand.begin() + k, cand.end(), [&](int a, int b) {
+            return dm.at(last, a) < dm.at(last, b);
+        });
+        int pick = cand[rng() % k];
+        used[pick] = 1;
+        seq.push_back(pick);
+    }
+    seq.push_back(dm.endCheckpoint());
+    return seq;
+}
+
+// reverse seq[i..j] if that shortens the tour
+bool tryTwoOpt(const DistanceMatrix& dm, vector<int>& seq) {
+    int last = (int)seq.size() - 2;
+    for (int i = 1; i < last; i++) {
+        long long inside = 0;  // change from driving seq[i..j] backwards
+        for (int j = i + 1; j <= last; j++) {
+            inside += (long long)dm.at(seq[j], seq[j-1]) - dm.at(seq[j-1], seq[j]);
+            long long before = (long long)dm.at(seq[i-1], seq[i]) + dm.at(seq[j], seq[j+1]);
+            long long after  = (long long)dm.at(seq[i-1], seq[j]) + dm.at(seq[i], seq[j+1]) + inside;
+            if (after < before) {
+                reverse(seq.begin() + i, seq.begin() + j + 1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// move seq[i..i+len-1] (maybe flipped) between seq[k] and seq[k+1]
+bool tryOrOpt(const DistanceMatrix& dm, vector<int>& seq) {
+    int last = (int)seq.size() - 2;
+    for (int len = 1; len <= 3; len++) {
+        for (int i = 1; i + len - 1 <= last; i++) {
+            int first = seq[i];
+            int end = seq[i + len - 1];
+            int before = seq[i-1];
+            int after = seq[i + len];
+            long long insideFwd = 0;
+            long long insideRev = 0;
+            for (int m = i; m < i + len - 1; m++) {
+                insideFwd += dm.at(seq[m], seq[m+1]);
+                insideRev += dm.at(seq[m+1], seq[m]);
+            }
+            long long removeGain = (long long)dm.at(before, first) + dm.at(end, after)
+                                 + insideFwd - dm.at(before, after);
+
+            for (int k = 0; k <= last; k++) {
+                if (k >= i - 1 && k <= i + len - 1) continue;
+                int a = seq[k];
+                int b = seq[k+1];
+                long long keep = (long long)dm.at(a, first) + dm.at(end, b) + insideFwd - dm.at(a, b);
+                long long flip = (long long)dm.at(a, end) + dm.at(first, b) + insideRev - dm.at(a, b);
+                bool flipped = flip < keep;
+                if (min(keep, flip) >= removeGain) continue;
+
+                vector<int> segment(seq.begin() + i, seq.begin() + i + len);
+                if (flipped) {
+                    reverse(segment.begin(), segment.end());
+                }
+                seq.erase(seq.begin() + i, seq.begin() + i + len);
+                int insertAt = (k < i) ? k + 1 : k + 1 - len;
+                seq.insert(seq.begin() + insertAt, segment.begin(), segment.end());
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Multi-start local search, restarts spread across threads. Each restart has
+// its own seed so the answer is the same every run.
+vector<int> localSearchOrder(const PlanContext& ctx, const DistanceMatrix& dm, int budgetMs) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(budgetMs);
+    vector<vector<int>> results(LOCAL_SEARCH_RESTARTS);
+    vector<long long> costs(LOCAL_SEARCH_RESTARTS, numeric_limits<long long>::max());
+
+    parallelFor(LOCAL_SEARCH_RESTARTS, [&](size_t r) {
+        // always finish restart 0 so there is an answer, unless nobody wants it
+        if (r > 0 && chrono::steady_clock::now() > deadline) return;
+        if (ctx.cancelled()) return;
+
+        mt19937 rng((unsigned)r + 1);
+        vector<int> seq = randomizedNearestNeighbour(dm, rng, r == 0 ? 1 : 3);
+        while (tryTwoOpt(dm, seq) || tryOrOpt(dm, seq)) {
+            if (r > 0 && chrono::steady_clock::now() > deadline) break;
+            if (ctx.cancelled()) break;
+        }
+        costs[r] = seqCost(dm, seq);
+        results[r] = seq;
+    }, 1);
+
+    size_t bestRun = min_element(costs.begin(), costs.end()) - costs.begin();
+    if (costs[bestRun] >= UNREACHABLE) {
+        return {};
+    }
+
+    // drop the start, add the robot end -> same shape as the other solvers
+    vector<int> order(results[bestRun].begin() + 1, results[bestRun].end());
+    order.push_back(dm.robotEnd());
+    return order;
+}
+
+// -----------------------------------------------------------------------------
+// all permutations of checkpoints, always finishing with the special end-checkpoint,
+// then finally going to robot end
+
+// past this many normal checkpoints the n! loop is too slow, use Held-Karp
+const int HELD_KARP_MIN_CHECKPOINTS = 8;
+// 2^n * n DP table gets too big after this
+const int HELD_KARP_MAX_CHECKPOINTS = 20;
+// branch-and-bound rarely gets anywhere past this, switch to local search
+const int LOCAL_SEARCH_MIN_CHECKPOINTS = 30;
+
+// Copy the normal checkpoints (excluding end checkpoint)
+vector<pair<int,int>> normalCheckpoints(const Track& track) {
+    vector<pair<int,int>> cpts = track.checkpoints;
+    cpts.erase(remove(cpts.begin(), cpts.end(), track.endCheckpoint), cpts.end());
+    return cpts;
+}
+
+// Picks the visiting order on a finished matrix. Sets best.stats.solver and
+// best.provenOptimal (for the matrix, see rerankByTourTime), returns the
+// matrix's tour cost (UNREACHABLE if there is none).
+int solveOrder(PlanContext& ctx, const DistanceMatrix& dm, vector<int>& bestOrder, PermResult& best) {
+    int n = dm.numCheckpoints;
+    int searchTimeBudgetMs = ctx.opt.searchTimeBudgetMs;
+    int bestCost = UNREACHABLE;
+    bestOrder.clear();
+
+    if (n >= HELD_KARP_MIN_CHECKPOINTS && n <= HELD_KARP_MAX_CHECKPOINTS) {
+        best.stats.solver = "held-karp";
+        bestOrder = heldKarpOrder(ctx, dm);
+        if (!bestOrder.empty()) {
+            bestCost = tourCost(dm, bestOrder);
+        }
+    }
+    else if (n >= LOCAL_SEARCH_MIN_CHECKPOINTS) {
+        best.stats.solver = "local search";
+        bestOrder = localSearchOrder(ctx, dm, searchTimeBudgetMs);
+        best.provenOptimal = false;
+        if (!bestOrder.empty()) {
+            bestCost = tourCost(dm, bestOrder);
+        }
+    }
+    else if (n > HELD_KARP_MAX_CHECKPOINTS) {
+        best.stats.solver = "branch and bound";
+        best.provenOptimal = branchAndBoundOrder(ctx, dm, searchTimeBudgetMs, bestOrder);
+        if (!bestOrder.empty()) {
+            bestCost = tourCost(dm, bestOrder);
+        }
+    }
+    else {
+        best.stats.solver = "permutations";
+        vector<int> order(n);
+        for (int i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        order.push_back(dm.endCheckpoint());
+        order.push_back(dm.robotEnd());
+
+        // only the normal checkpoints get permuted
+        do {
+            int cost = tourCost(dm, order);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestOrder = order;
+            }
+        } while (next_permutation(order.begin(), order.begin() + n));
+    }
+    reportTour(ctx, dm, bestOrder, bestCost);
+    return bestCost;
+}
+
+// at most this many orders besides the winner get driven through
+// planTimedTour() by rerankByTourTime(); each costs about as much as the
+// winner's own route, more would push an edit past a frame
+const int RERANK_MAX_TOURS = 2;
+
+// The matrix leaves the heading free at every checkpoint and stops there, so
+// tourCost() is off from what an order really takes both ways: turning to a
+// heading costs, driving straight on through a checkpoint saves its stop.
+// Knock the stop off every leg out of a checkpoint and it is a lower bound.
+// Drives the winner with planTimedTour(), then the orders whose bound still
+// beats it, lowest first: all of them below HELD_KARP_MIN_CHECKPOINTS, else
+// the winner with one checkpoint moved. Keeps the fastest in `order` and
+// returns its ms. best.provenOptimal only survives if no order could still
+// be faster.
+int rerankByTourTime(PlanContext& ctx, const DistanceMatrix& dm, vector<int>& order, PermResult& best) {
+    if (order.empty()) {
+        return UNREACHABLE;
+    }
+    int bestMs = planTimedTour(ctx, waypointsFor(dm, order), ctx.opt.allowTurns, ctx.tourStates, ctx.tourEndLeg);
+    const int slackMs = ((int)order.size() - 1) * arrivalSlackMs(ctx, false);
+    int n = dm.numCheckpoints;
+    bool everyOrder = n < HELD_KARP_MIN_CHECKPOINTS;
+    // below that every order gets a look; else, if the matrix search was
+    // exact, no order has a lower bound than the winner's
+    bool ruledOut = everyOrder || bestMs <= tourCost(dm, order) - slackMs;
+
+    // the lowest RERANK_MAX_TOURS + 1 (cost, order), the last one only tells
+    // whether anything past the cap could still win
+    vector<pair<int, vector<int>>> candidates;
+    auto consider = [&](const vector<int>& other) {
+        int cost = tourCost(dm, other);
+        if (cost >= UNREACHABLE || cost - slackMs >= bestMs || other == order) return;
+        if ((int)candidates.size() == RERANK_MAX_TOURS + 1) {
+            if (cost >= candidates.back().first) return;
+            candidates.pop_back();
+        }
+        auto at = upper_bound(candidates.begin(), candidates.end(), cost,
+                              [](int c, const pair<int, vector<int>>& e) { return c < e.first; });
+        candidates.insert(at, { cost, other });
+    };
+
+    if (everyOrder) {
+        vector<int> other(order.begin(), order.begin() + n);
+        sort(other.begin(), other.end());
+        other.push_back(dm.endCheckpoint());
+        other.push_back(dm.robotEnd());
+        do {
+            consider(other);
+        } while (next_permutation(other.begin(), other.begin() + n));
+    } else {
+        vector<int> other;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                if (i == j) continue;
+                other.assign(order.begin(), order.end());
+                other.erase(other.begin() + i);
+                other.insert(other.begin() + j, order[i]);
+                consider(other);
+            }
+        }
+    }
+
+    for (int i = 0; i < (int)candidates.size(); i++) {
+        if (candidates[i].first - slackMs >= bestMs) break;
+        if (i == RERANK_MAX_TOURS) {
+            ruledOut = false;
+            break;
+        }
+        vector<int> states;
+        int endLeg;
+        int ms = planTimedTour(ctx, waypointsFor(dm, candidates[i].second), ctx.opt.allowTurns, states, endLeg);
+        if (ms < bestMs) {
+            bestMs = ms;
+            order = candidates[i].second;
+            ctx.tourStates.swap(states);
+            ctx.tourEndLeg = endLeg;
+        }
+    }
+    if (bestMs < UNREACHABLE) {
+        ctx.tourWaypoints = waypointsFor(dm, order);
+    }
+    best.provenOptimal = best.provenOptimal && ruledOut;
+    reportTour(ctx, dm, order, bestMs);
+    return bestMs;
+}
+
+// the winning order; only plan() or findBestPermutation() turn it into a route
+void finishPermutation(PlanContext& ctx, const DistanceMatrix& dm, const vector<int>& bestOrder,
+                       int bestCost, PermResult& best) {
+    if (bestCost >= UNREACHABLE) {
+        return;
+    }
+    best.dist = bestCost / 1000.0;
+    best.waypoints = waypointsFor(dm, bestOrder);
+}
+
+PermResult findBestPermutation(PlanContext& ctx) {
+    PermResult best;
+    best.dist = numeric_limits<double>::infinity();
+
+    // every leg distance comes from here, the searches below only add ints
+    DistanceMatrix dm = buildDistanceMatrix(ctx, normalCheckpoints(ctx.track));
+
+    vector<int> bestOrder;
+    solveOrder(ctx, dm, bestOrder, best);
+    int bestCost = rerankByTourTime(ctx, dm, bestOrder, best);
+    finishPermutation(ctx, dm, bestOrder, bestCost, best);
+    return best;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Move from corner/edge to center (or center to corner/edge). Both tables
+// come from the frame transform at compile time: out from the center the
+// robot drives first and then strafes, the way back is the mirror image.
+// -----------------------------------------------------------------------------
+
+struct PartialTable {
+    PartialSteps at[4][9];            // [RobotOrientation][PositionType]
+};
+
+constexpr PartialTable buildPartialTable(bool toCenter) {
+    PartialTable t{};
+    for (int ori = 0; ori < 4; ori++) {
+        for (int pos = 0; pos < 9; pos++) {
+            int dx = toCenter ? -POSITION_DX[pos] : POSITION_DX[pos];
+            int dy = toCenter ? -POSITION_DY[pos] : POSITION_DY[pos];
+            // + = forward / right of the heading
+            int along = dx * DIR_DX[ori] + dy * DIR_DY[ori];
+            int side = dx * DIR_DX[(ori + 1) % 4] + dy * DIR_DY[(ori + 1) % 4];
+            MotionCommand drive = motion(along > 0 ? PRIM_FORWARD : PRIM_BACKWARD, HALF_CELL);
+            MotionCommand strafe = motion(side > 0 ? PRIM_RIGHT : PRIM_LEFT, HALF_CELL);
+
+            PartialSteps& steps = t.at[ori][pos];
+            if (!toCenter && along != 0) steps.steps[steps.count++] = drive;
+            if (side != 0)               steps.steps[steps.count++] = strafe;
+            if (toCenter && along != 0)  steps.steps[steps.count++] = drive;
+        }
+    }
+    return t;
+}
+
+constexpr PartialTable PARTIAL_TO_CENTER = buildPartialTable(true);
+constexpr PartialTable PARTIAL_FROM_CENTER = buildPartialTable(false);
+
+// every sequence has to land where it says, in half-cells
+constexpr bool partialTableLands(const PartialTable& t, bool toCenter) {
+    for (int ori = 0; ori < 4; ori++) {
+        for (int pos = 0; pos < 9; pos++) {
+            int x = toCenter ? POSITION_DX[pos] : 0;
+            int y = toCenter ? POSITION_DY[pos] : 0;
+            for (int i = 0; i < t.at[ori][pos].count; i++) {
+                int dir = moveDir(ori, t.at[ori][pos].steps[i].prim);
+                x += DIR_DX[dir];
+                y += DIR_DY[dir];
+            }
+            if (x != (toCenter ? 0 : POSITION_DX[pos]) || y != (toCenter ? 0 : POSITION_DY[pos])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(partialTableLands(PARTIAL_TO_CENTER, true), "half-steps to center miss");
+static_assert(partialTableLands(PARTIAL_FROM_CENTER, false), "half-steps from center miss");
+
+const PartialSteps& partialStepsFromPosTypeToCenter(PositionType posType, RobotOrientation ori) {
+    return PARTIAL_TO_CENTER.at[ori][posType];
+}
+
+const PartialSteps& partialStepsFromCenterToPosType(PositionType posType, RobotOrientation ori) {
+    return PARTIAL_FROM_CENTER.at[ori][posType];
+}
+
+// -----------------------------------------------------------------------------
+// allow the robot to start on the very edge: positions on the grid border
+// are fine, only a half-step that ends outside the grid, or runs along or
+// through a wall, fails. Works on the half-cell lattice (see halfStepOpen).
+// -----------------------------------------------------------------------------
+
+namespace {
+
+bool partialStepsOpen(const Track& track, int hx, int hy, const PartialSteps& steps, RobotOrientation ori) {
+    for (int i = 0; i < steps.count; i++) {
+        int dir = moveDir(ori, steps.steps[i].prim);
+        if (!halfStepOpen(track, hx, hy, dir)) {
+            return false;
+        }
+        hx += DIR_DX[dir];
+        hy += DIR_DY[dir];
+    }
+    return true;
+}
+
+} // namespace
+
+bool canDoPartialStepsToCenter(const Track& track, int x, int y, PositionType posType, RobotOrientation ori) {
+    return partialStepsOpen(track, 2 * x + 1 + POSITION_DX[posType], 2 * y + 1 + POSITION_DY[posType],
+                            partialStepsFromPosTypeToCenter(posType, ori), ori);
+}
+
+bool canDoPartialStepsFromCenter(const Track& track, int x, int y, PositionType posType, RobotOrientation ori) {
+    return partialStepsOpen(track, 2 * x + 1, 2 * y + 1, partialStepsFromCenterToPosType(posType, ori), ori);
+}
+
+// -----------------------------------------------------------------------------
+// Convert  final BFS path from center to center into the robot commands
+// plus the fixed partial steps at start and end. plan() picks its own on the
+// half-cell lattice instead (see tourCommands).
+vector<MotionCommand> Planner::pathToCommands(const Track& track, const vector<pair<int,int>>& path,
+                                              RobotOrientation ori) const {
+    if (path.empty()) {
+        return {};
+    }
+
+    vector<MotionCommand> commands;
+
+    // 1) Partial steps from actual start positionType to the cell center
+    const PartialSteps& prefix = partialStepsFromPosTypeToCenter(track.robotStartState.positionType, ori);
+    commands.insert(commands.end(), prefix.steps, prefix.steps + prefix.count);
+
+    // 2) Convert BFS center-to-center path into movement commands
+    for (size_t i = 0; i + 1 < path.size(); i++) {
+        auto [px, py] = path[i];
+        auto [nx, ny] = path[i+1];
+        for (int dir = 0; dir < 4; dir++) {
+            if (nx - px == DIR_DX[dir] && ny - py == DIR_DY[dir]) {
+                commands.push_back(unitMotion(movePrim(ori, dir)));
+            }
+        }
+    }
+
+    // 3) Partial steps from the center to the end positionType
+    const PartialSteps& suffix = partialStepsFromCenterToPosType(track.robotEndState.positionType, ori);
+    commands.insert(commands.end(), suffix.steps, suffix.steps + suffix.count);
+
+    return commands;
+}
+
+// -----------------------------------------------------------------------------
+// Route output for plan(). On the mecanum chassis strafing is slower and
+// drifts more than driving forward, so with `turns` the robot may also rotate
+// in place; with the calibrated times the timed search picks turn + forward
+// wherever that beats strafing.
+// Unlike pathToCommands() the half-steps at either end are the lattice legs
+// the search picked: whichever side of the start and end point was cheapest
+// without running along a wall. `path` gets the cells the same states drive
+// through, so the drawn route is the one the commands follow.
+namespace {
+
+vector<MotionCommand> tourCommands(PlanContext& ctx, const vector<pair<int,int>>& waypoints, bool turns,
+                                   vector<pair<int,int>>& path) {
+    vector<int> states;
+    int endLeg;
+    if (waypoints.empty()) {
+        return {};
+    }
+    if (waypoints == ctx.tourWaypoints && turns == ctx.opt.allowTurns) {
+        states = ctx.tourStates;
+        endLeg = ctx.tourEndLeg;
+    } else if (planTimedTour(ctx, waypoints, turns, states, endLeg) >= UNREACHABLE) {
+        return {};
+    }
+    path = statesPath(ctx, states);
+
+    // the start leg that seeded the first state (the cheapest, if several did)
+    const LatticeLeg* startLeg = nullptr;
+    for (const LatticeLeg& leg : ctx.startLegs) {
+        if (startLegState(leg) != states[0]) continue;
+        if (!startLeg || latticeLegMs(ctx, leg, NO_PRIM) < latticeLegMs(ctx, *startLeg, NO_PRIM)) {
+            startLeg = &leg;
+        }
+    }
+
+    vector<MotionCommand> commands(startLeg->steps.steps, startLeg->steps.steps + startLeg->steps.count);
+    for (size_t i = 1; i < states.size(); i++) {
+        commands.push_back(unitMotion(stateLastPrim(states[i])));
+    }
+    const PartialSteps& suffix = ctx.endLegs[endLeg].steps;
+    commands.insert(commands.end(), suffix.steps, suffix.steps + suffix.count);
+    return commands;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Optimization pass after pathToCommands(): the firmware stops after every
+// command, so a straight run of unit moves (half-steps included) becomes one
+// segment, e.g. forward(0.5) forward(1) forward(1) -> forward(2.5).
+// Turns stay separate.
+vector<MotionCommand> coalesceCommands(const vector<MotionCommand>& commands) {
+    vector<MotionCommand> merged;
+    for (const MotionCommand& c : commands) {
+        if (!isTurn(c.prim) && !merged.empty() && merged.back().prim == c.prim) {
+            merged.back().distance += c.distance;
+        } else {
+            merged.push_back(c);
+        }
+    }
+    return merged;
+}
+
+// -----------------------------------------------------------------------------
+// Predicted run time of a command list under the cost model. Half-steps drive
+// half a cell but still pay the full stop.
+double predictedSeconds(const vector<MotionCommand>& commands, const CostModel& costModel) {
+    double total = 0;
+    int lastPrim = NO_PRIM;
+    for (const MotionCommand& c : commands) {
+        double cells = isTurn(c.prim) ? 1.0 : commandCells(c);
+        total += costModel.commandSec(c.prim, cells, lastPrim);
+        lastPrim = c.prim;
+    }
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+// Pacing
+namespace {
+
+// longest extra pause at one stop; past this the robot looks like it's done
+const int MAX_EXTRA_DWELL_MS = 5000;
+
+// the sketch's single-letter moves (test_code.ino w/s/a/d/q/e)
+const char PRIMITIVE_KEY[NUM_PRIMITIVES] = { 'w', 's', 'a', 'd', 'q', 'e' };
+
+// Every command at `slowdown` times its calibrated duration (capped by its
+// minPwm), with PWMs rounded the way the robot will get them. Dwells are
+// just the stops. Returns the total in ms.
+int slowedSchedule(const vector<MotionCommand>& commands, const CostModel& model, double slowdown,
+                   vector<TimedCommand>& steps) {
+    int calibration = max(1, min(255, model.calibrationPwm));
+    int total = 0;
+    steps.resize(commands.size());
+    for (size_t i = 0; i < commands.size(); i++) {
+        const MotionCommand& c = commands[i];
+        int minPwm = max(1, min(calibration, model.minPwm[c.prim]));
+        int pwm = max(minPwm, (int)lround(calibration / slowdown));
+        double cells = isTurn(c.prim) ? 1.0 : commandCells(c);
+        double driveMs = model.moveSec[c.prim] * cells * 1000.0 * calibration / pwm;
+
+        // settling for a new move type happens at the stop before it
+        double dwellMs = model.stopSec * 1000.0;
+        if (i + 1 < commands.size() && commands[i + 1].prim != c.prim) {
+            dwellMs += model.directionChangeSec * 1000.0;
+        }
+
+        steps[i] = { c, (uint8_t)pwm, (uint16_t)min(65535L, lround(driveMs)), (uint16_t)min(65535L, lround(dwellMs)) };
+        total += steps[i].driveMs + steps[i].dwellMs;
+    }
+    return total;
+}
+
+} // namespace
+
+PacedSchedule paceCommands(const vector<MotionCommand>& commands, const CostModel& model, double targetSeconds) {
+    PacedSchedule paced;
+    if (commands.empty()) {
+        paced.error = "No commands to pace.";
+        return paced;
+    }
+    int targetMs = (int)lround(targetSeconds * 1000.0);
+
+    int fastestMs = slowedSchedule(commands, model, 1.0, paced.steps);
+    if (targetSeconds <= 0) {
+        paced.predictedSeconds = fastestMs / 1000.0;
+        paced.onTarget = true;
+        return paced;
+    }
+    if (fastestMs > targetMs) {
+        paced.predictedSeconds = fastestMs / 1000.0;
+        paced.error = "Target is shorter than the fastest run.";
+        return paced;
+    }
+
+    // largest slowdown that still fits; past the last minPwm nothing changes
+    double lo = 1.0;
+    double hi = 1.0;
+    for (const MotionCommand& c : commands) {
+        hi = max(hi, (double)model.calibrationPwm / max(1, model.minPwm[c.prim]));
+    }
+    if (slowedSchedule(commands, model, hi, paced.steps) <= targetMs) {
+        lo = hi;
+    } else {
+        for (int iter = 0; iter < 40; iter++) {
+            double mid = (lo + hi) / 2;
+            if (slowedSchedule(commands, model, mid, paced.steps) <= targetMs) lo = mid;
+            else hi = mid;
+        }
+    }
+    int totalMs = slowedSchedule(commands, model, lo, paced.steps);
+
+    // the rest as pauses, spread evenly over the stops between commands
+    int slots = (int)commands.size() - 1;
+    int spare = targetMs - totalMs;
+    for (int i = 0; i < slots && spare > 0; i++) {
+        int extra = min(MAX_EXTRA_DWELL_MS, (spare + (slots - i) - 1) / (slots - i));
+        paced.steps[i].dwellMs = (uint16_t)(paced.steps[i].dwellMs + extra);
+        spare -= extra;
+        totalMs += extra;
+    }
+
+    paced.predictedSeconds = totalMs / 1000.0;
+    paced.onTarget = spare == 0;
+    if (!paced.onTarget) {
+        paced.error = "Target is longer than the slowest run with pauses.";
+    }
+    return paced;
+}
+
+string timedCommandText(const TimedCommand& c) {
+    ostringstream text;
+    text << "{ '" << PRIMITIVE_KEY[c.command.prim] << "', " << (int)c.pwm << ", "
+         << c.driveMs << ", " << c.dwellMs << " },  // " << commandText(c.command);
+    return text.str();
+}
+
+// -----------------------------------------------------------------------------
+// Planner
+Planner::Planner(const PlannerOptions& options)
+    : opts(options), pool(make_unique<WorkspacePool>()) {}
+
+Planner::~Planner() = default;
+
+void Planner::addStats(const PlanContext& ctx) {
+    bfsRuns += ctx.bfsRuns;
+    workspaceAllocations += ctx.workspaceAllocations;
+    nodesExpanded += ctx.nodesExpanded;
+}
+
+vector<pair<int,int>> Planner::shortestPathBetween(const Track& track, pair<int,int> start,
+                                                   pair<int,int> goal) {
+    PlanContext ctx(track, opts, *pool);
+    vector<pair<int,int>> path = ::shortestPathBetween(ctx, start, goal);
+    addStats(ctx);
+    return path;
+}
+
+PermResult Planner::findBestPermutation(const Track& track) {
+    PlanContext ctx(track, opts, *pool);
+    PermResult best = ::findBestPermutation(ctx);
+    best.finalPath = tourPath(ctx, best.waypoints);
+    best.stats.bfsRuns = ctx.bfsRuns;
+    best.stats.workspaceAllocations = ctx.workspaceAllocations;
+    best.stats.nodesExpanded = ctx.nodesExpanded;
+    addStats(ctx);
+    return best;
+}
+
+// Everything that can be ruled out before searching
+bool Planner::checkTrack(const PlanContext& ctx, PlanResult& result) const {
+    const Track& track = ctx.track;
+    if (!track.robotStartState.valid || !track.robotEndState.valid || track.endCheckpoint.first < 0) {
+        result.error = "Not all conditions met (start/end or end checkpoint not set).";
+        return false;
+    }
+
+    // start corner/edge => some cell center, and back out to the end one
+    if (ctx.startLegs.empty()) {
+        result.error = "Cannot move from start corner/edge to center without going off-grid or along a wall.";
+        return false;
+    }
+    if (ctx.endLegs.empty()) {
+        result.error = "Cannot move from center to final corner/edge without going off-grid or along a wall.";
+        return false;
+    }
+    return true;
+}
+
+// Commands for the winning tour
+void Planner::finishPlan(PlanContext& ctx, const PermResult& best, PlanResult& result) const {
+    result.stats.solver = best.stats.solver;
+    // the drawn path comes from the same search as the commands
+    vector<pair<int,int>> path;
+    vector<MotionCommand> commands = tourCommands(ctx, best.waypoints, opts.allowTurns, path);
+    if (opts.coalesceMoves) {
+        commands = coalesceCommands(commands);
+    }
+    if (commands.empty()) {
+        result.error = "No path found.";
+        return;
+    }
+
+    result.found = true;
+    result.commands = commands;
+    result.path = path;
+    result.waypoints = best.waypoints;
+    result.totalDistance = commandDistance(commands);
+    result.predictedSeconds = predictedSeconds(commands, opts.costModel);
+    result.provenOptimal = best.provenOptimal;
+}
+
+void Planner::finishStats(PlanContext& ctx, chrono::steady_clock::time_point started, PlanStats& stats) {
+    stats.bfsRuns = ctx.bfsRuns;
+    stats.workspaceAllocations = ctx.workspaceAllocations;
+    stats.nodesExpanded = ctx.nodesExpanded;
+    stats.elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    addStats(ctx);
+}
+
+// Whatever a cancelled search left behind is incomplete, don't build on it
+bool Planner::checkCancelled(const PlanContext& ctx, PlanResult& result) const {
+    if (!ctx.cancelled()) {
+        return false;
+    }
+    result.cancelled = true;
+    result.error = "Cancelled.";
+    return true;
+}
+
+PlanResult Planner::plan(const Track& track, PlanProgress* progress) {
+    auto started = chrono::steady_clock::now();
+    PlanResult result;
+    PlanContext ctx(track, opts, *pool, progress);
+
+    if (checkTrack(ctx, result)) {
+        // BFS permutations among checkpoints
+        PermResult best = ::findBestPermutation(ctx);
+        if (!checkCancelled(ctx, result)) {
+            finishPlan(ctx, best, result);
+        }
+    }
+    finishStats(ctx, started, result.stats);
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Cells driven by a command list; turning in place doesn't cover any distance.
+double commandDistance(const vector<MotionCommand>& commands) {
+    int units = 0;
+    for (const MotionCommand& c : commands) {
+        units += c.distance;
+    }
+    return (double)units / CELL_UNITS;
+}
+
+// -----------------------------------------------------------------------------
+// Incremental planner
+
+// past this many changed walls in one setTrack, searching again is cheaper
+const int INCREMENTAL_MAX_WALL_EDITS = 16;
+
+struct IncrementalPlanner::Impl {
+    // one timed search, kept whole: cost and parent of every state
+    struct Source {
+        vector<pair<int,int>> seeds;  // (state, ms) it was started from, see legSeeds
+        vector<int> cost;          // UNREACHABLE if never reached
+        vector<int> parent;
+        vector<uint8_t> mark;      // scratch for closing walls
+        vector<pair<int,int>> heap;
+    };
+
+    Planner& planner;
+    Track track;
+    bool haveTrack = false;
+    vector<unique_ptr<Source>> sources;
+
+    // last solved matrix and tour, to see if the order can be kept
+    vector<pair<int,int>> lastPoints;
+    vector<int> lastDist;
+    vector<int> lastOrder;
+    PermResult lastBest;
+
+    IncrementalStats pending;
+    IncrementalStats last;
+
+    explicit Impl(Planner& p) : planner(p) {}
+
+    bool turns() const { return planner.opts.allowTurns; }
+
+    void search(PlanContext& ctx, Source& src) {
+        BfsWorkspaceLease lease(ctx.pool);
+        BfsWorkspace& ws = *lease.ws;
+        runTimedSearch(ctx, ws, src.seeds, turns(), -1);
+
+        int numStates = ctx.gSize * ctx.gSize * STATES_PER_CELL;
+        src.cost.assign(numStates, UNREACHABLE);
+        src.parent.assign(numStates, -1);
+        for (int st = 0; st < numStates; st++) {
+            if (ws.stateVisited(st)) {
+                src.cost[st] = ws.stateCost[st];
+                src.parent[st] = ws.stateParent[st];
+            }
+        }
+    }
+
+    // Dijkstra on from whatever is in src.heap, only ever lowering costs
+    long long propagate(PlanContext& ctx, Source& src) {
+        auto later = [](const pair<int,int>& a, const pair<int,int>& b) { return a.first > b.first; };
+        long long expanded = 0;
+        while (!src.heap.empty()) {
+            pop_heap(src.heap.begin(), src.heap.end(), later);
+            auto [c, st] = src.heap.back();
+            src.heap.pop_back();
+            if (c > src.cost[st]) continue;
+            expanded++;
+
+            forEachSuccessor(ctx, st, turns(), [&, c = c, st = st](int next, int stepMs) {
+                int nc = c + stepMs;
+                if (nc < src.cost[next]) {
+                    src.cost[next] = nc;
+                    src.parent[next] = st;
+                    src.heap.push_back({nc, next});
+                    push_heap(src.heap.begin(), src.heap.end(), later);
+                }
+            });
+        }
+        ctx.nodesExpanded += expanded;
+        return expanded;
+    }
+
+    void push(Source& src, int st, int c, int parent) {
+        auto later = [](const pair<int,int>& a, const pair<int,int>& b) { return a.first > b.first; };
+        src.cost[st] = c;
+        src.parent[st] = parent;
+        src.heap.push_back({c, st});
+        push_heap(src.heap.begin(), src.heap.end(), later);
+    }
+
+    // The wall between cells a and b was just removed: relax every move out
+    // of the two cells and let the improvements spread.
+    long long repairOpened(PlanContext& ctx, Source& src, int a, int b) {
+        src.heap.clear();
+        for (int cell : { a, b }) {
+            for (int st = cell * STATES_PER_CELL; st < (cell + 1) * STATES_PER_CELL; st++) {
+                if (src.cost[st] >= UNREACHABLE) continue;
+                forEachSuccessor(ctx, st, turns(), [&](int next, int stepMs) {
+                    if (src.cost[st] + stepMs < src.cost[next]) {
+                        push(src, next, src.cost[st] + stepMs, st);
+                    }
+                });
+            }
+        }
+        return propagate(ctx, src);
+    }
+
+    // The wall between cells a and b was just added: every state whose parent
+    // chain crosses it is dropped, then re-seeded from its cheapest surviving
+    // predecessor (or its own seed cost, if it was a seed). Nothing else can
+    // change, costs only went up.
+    long long repairClosed(PlanContext& ctx, Source& src, int a, int b) {
+        enum { UNKNOWN, KEEP, DROP };
+        int numStates = (int)src.cost.size();
+        src.mark.assign(numStates, UNKNOWN);
+        auto crosses = [&](int st) {
+            int par = src.parent[st];
+            if (par == -1) return false;
+            int from = stateCell(par);
+            int to = stateCell(st);
+            return (from == a && to == b) || (from == b && to == a);
+        };
+
+        vector<int> chain;
+        vector<int> dropped;
+        for (int st = 0; st < numStates; st++) {
+            if (src.cost[st] >= UNREACHABLE || src.mark[st] != UNKNOWN) continue;
+            chain.clear();
+            int cur = st;
+            uint8_t verdict;
+            while (true) {
+                if (src.mark[cur] != UNKNOWN) { verdict = src.mark[cur]; break; }
+                if (crosses(cur))             { verdict = DROP; chain.push_back(cur); break; }
+                chain.push_back(cur);
+                if (src.parent[cur] == -1)    { verdict = KEEP; break; }
+                cur = src.parent[cur];
+            }
+            for (int s : chain) {
+                src.mark[s] = verdict;
+                if (verdict == DROP) dropped.push_back(s);
+            }
+        }
+        if (dropped.empty()) {
+            return 0;
+        }
+
+        for (int st : dropped) {
+            src.cost[st] = UNREACHABLE;
+            src.parent[st] = -1;
+        }
+        src.heap.clear();
+        for (int st : dropped) {
+            int best = UNREACHABLE;
+            int bestPrev = -1;
+            forEachPredecessor(ctx, st, turns(), [&](int prev, int stepMs) {
+                if (src.cost[prev] < UNREACHABLE && src.cost[prev] + stepMs < best) {
+                    best = src.cost[prev] + stepMs;
+                    bestPrev = prev;
+                }
+            });
+            for (auto [seed, c] : src.seeds) {
+                if (seed == st && c < best) {
+                    best = c;
+                    bestPrev = -1;
+                }
+            }
+            if (best < UNREACHABLE) {
+                push(src, st, best, bestPrev);
+            }
+        }
+        return (long long)dropped.size() + propagate(ctx, src);
+    }
+
+    // cell + direction of one wall that changed; toggles it and patches every search
+    void applyWallEdit(PlanContext& ctx, int cell, int dir) {
+        int x = cell % track.gSize;
+        int y = cell / track.gSize;
+        int other = cell + (dir == RIGHT ? 1 : track.gSize);
+        if (dir == RIGHT) track.toggleVerticalWall(x, y);
+        else              track.toggleHorizontalWall(x, y);
+        bool opened = (track.openDirs[cell] >> dir) & 1;
+
+        // repairs are small, starting threads for them costs more than they do
+        for (auto& src : sources) {
+            long long touched = opened ? repairOpened(ctx, *src, cell, other) : repairClosed(ctx, *src, cell, other);
+            if (touched > 0) {
+                pending.sourcesRepaired++;
+                pending.statesRepaired += touched;
+            }
+        }
+    }
+
+    // A search is only reused for exactly the same seeds: a start leg that
+    // changed with the walls needs a new one.
+    Source& sourceFor(const PlanContext& ctx, pair<int,int> point, bool isStart, vector<unique_ptr<Source>>& kept) {
+        vector<pair<int,int>> seeds;
+        legSeeds(ctx, point, isStart, seeds);
+        for (auto& src : kept) {
+            if (src && src->seeds == seeds) return *src;
+        }
+        for (auto& src : sources) {
+            if (src && src->seeds == seeds) {
+                kept.push_back(move(src));
+                return *kept.back();
+            }
+        }
+        kept.push_back(make_unique<Source>());
+        kept.back()->seeds = move(seeds);
+        return *kept.back();
+    }
+};
+
+IncrementalPlanner::IncrementalPlanner(Planner& planner) : impl(make_unique<Impl>(planner)) {}
+
+IncrementalPlanner::~IncrementalPlanner() = default;
+
+const Track& IncrementalPlanner::track() const {
+    return impl->track;
+}
+
+const IncrementalStats& IncrementalPlanner::lastStats() const {
+    return impl->last;
+}
+
+void IncrementalPlanner::setTrack(const Track& newTrack) {
+    Impl& m = *impl;
+    if (!m.haveTrack || newTrack.gSize != m.track.gSize) {
+        m.track = newTrack;
+        m.haveTrack = true;
+        m.sources.clear();
+        m.lastOrder.clear();
+        return;
+    }
+
+    // walls that differ, as (cell, RIGHT) / (cell, DOWN)
+    vector<pair<int,int>> edits;
+    for (int pass = 0; pass < 2; pass++) {
+        const vector<uint64_t>& before = pass == 0 ? m.track.verticalWalls : m.track.horizontalWalls;
+        const vector<uint64_t>& after = pass == 0 ? newTrack.verticalWalls : newTrack.horizontalWalls;
+        for (size_t w = 0; w < before.size(); w++) {
+            uint64_t diff = before[w] ^ after[w];
+            for (int bit = 0; bit < 64; bit++) {
+                if ((diff >> bit) & 1) edits.push_back({ (int)(w * 64 + bit), pass == 0 ? RIGHT : DOWN });
+            }
+        }
+    }
+
+    if ((int)edits.size() > INCREMENTAL_MAX_WALL_EDITS) {
+        m.track = newTrack;
+        m.sources.clear();
+        m.lastOrder.clear();
+        return;
+    }
+
+    PlanContext ctx(m.track, m.planner.opts, *m.planner.pool);
+    for (auto [cell, dir] : edits) {
+        m.applyWallEdit(ctx, cell, dir);
+    }
+    m.planner.addStats(ctx);
+
+    m.track.checkpoints = newTrack.checkpoints;
+    m.track.endCheckpoint = newTrack.endCheckpoint;
+    m.track.robotStartState = newTrack.robotStartState;
+    m.track.robotEndState = newTrack.robotEndState;
+}
+
+PlanResult IncrementalPlanner::plan(PlanProgress* progress) {
+    Impl& m = *impl;
+    auto started = chrono::steady_clock::now();
+    PlanResult result;
+    PlanContext ctx(m.track, m.planner.opts, *m.planner.pool, progress);
+    m.last = m.pending;
+    m.pending = IncrementalStats();
+
+    if (!m.haveTrack || !m.planner.checkTrack(ctx, result)) {
+        m.planner.finishStats(ctx, started, result.stats);
+        return result;
+    }
+
+    // same points as buildDistanceMatrix, each backed by a kept search
+    DistanceMatrix dm;
+    vector<pair<int,int>> cpts = normalCheckpoints(m.track);
+    dm.numCheckpoints = (int)cpts.size();
+    dm.points = cpts;
+    dm.points.push_back({m.track.robotStartState.gridX, m.track.robotStartState.gridY});
+    dm.points.push_back(m.track.endCheckpoint);
+    dm.points.push_back({m.track.robotEndState.gridX, m.track.robotEndState.gridY});
+    int numPts = (int)dm.points.size();
+
+    vector<unique_ptr<Impl::Source>> kept;
+    vector<Impl::Source*> rows(numPts);
+    for (int a = 0; a < numPts; a++) {
+        rows[a] = &m.sourceFor(ctx, dm.points[a], a == dm.start(), kept);
+    }
+    m.sources = move(kept);
+
+    vector<Impl::Source*> fresh;
+    for (auto& src : m.sources) {
+        if (src->cost.empty()) fresh.push_back(src.get());
+    }
+    if (progress) {
+        progress->legsTotal = numPts;
+        progress->legsSearched = numPts - (int)fresh.size();
+    }
+    parallelFor(fresh.size(), [&](size_t i) {
+        m.search(ctx, *fresh[i]);
+        if (progress) {
+            progress->legsSearched++;
+        }
+    }, 1);
+    m.last.sourcesSearched = (int)fresh.size();
+
+    if (m.planner.checkCancelled(ctx, result)) {
+        // searches cut short would poison every later repair, drop them
+        m.sources.erase(remove_if(m.sources.begin(), m.sources.end(), [&](const unique_ptr<Impl::Source>& src) {
+            return find(fresh.begin(), fresh.end(), src.get()) != fresh.end();
+        }), m.sources.end());
+        m.planner.finishStats(ctx, started, result.stats);
+        return result;
+    }
+
+    dm.dist.assign(numPts * numPts, UNREACHABLE);
+    for (int a = 0; a < numPts; a++) {
+        const vector<int>& cost = rows[a]->cost;
+        for (int b = 0; b < numPts; b++) {
+            if (b == dm.robotEnd()) {
+                dm.dist[a * numPts + b] = bestEndArrival(ctx, [&cost](int st) { return cost[st]; });
+                continue;
+            }
+            int cell = dm.points[b].second * m.track.gSize + dm.points[b].first;
+            int best = UNREACHABLE;
+            for (int st = cell * STATES_PER_CELL; st < (cell + 1) * STATES_PER_CELL; st++) {
+                best = min(best, cost[st]);
+            }
+            dm.dist[a * numPts + b] = best;
+        }
+    }
+
+    // The old order still wins if every leg that changed either got cheaper
+    // and is on the old tour, or got dearer and isn't: no other tour can have
+    // gained on it.
+    bool reuse = !m.lastOrder.empty() && m.lastBest.provenOptimal && dm.points == m.lastPoints;
+    if (reuse) {
+        vector<char> onTour(numPts * numPts, 0);
+        int prev = dm.start();
+        for (int idx : m.lastOrder) {
+            onTour[prev * numPts + idx] = 1;
+            prev = idx;
+        }
+        for (int e = 0; e < numPts * numPts && reuse; e++) {
+            if (dm.dist[e] < m.lastDist[e] && !onTour[e]) reuse = false;
+            if (dm.dist[e] > m.lastDist[e] && onTour[e])  reuse = false;
+        }
+    }
+
+    PermResult best;
+    best.dist = numeric_limits<double>::infinity();
+    vector<int> order;
+    int bestCost;
+    if (reuse) {
+        order = m.lastOrder;
+        bestCost = tourCost(dm, order);
+        best.stats.solver = m.lastBest.stats.solver;
+    } else {
+        bestCost = solveOrder(ctx, dm, order, best);
+    }
+    m.last.orderReused = reuse;
+    if (reuse) {
+        reportTour(ctx, dm, order, bestCost);
+    }
+
+    if (m.planner.checkCancelled(ctx, result)) {
+        m.planner.finishStats(ctx, started, result.stats);
+        return result;
+    }
+
+    if (bestCost >= UNREACHABLE) {
+        m.lastOrder.clear();
+    } else {
+        m.lastPoints = dm.points;
+        m.lastDist = dm.dist;
+        m.lastOrder = order;
+        m.lastBest = best;
+    }
+
+    // the matrix winner stays in lastOrder, the reuse test above is about it
+    bestCost = rerankByTourTime(ctx, dm, order, best);
+    finishPermutation(ctx, dm, order, bestCost, best);
+    if (!m.planner.checkCancelled(ctx, result)) {
+        m.planner.finishPlan(ctx, best, result);
+    }
+    m.planner.finishStats(ctx, started, result.stats);
+    return result;
+}
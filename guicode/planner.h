@@ -0,0 +1,364 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Robot Tour path planner. No SFML in here: fill in a Track, hand it to a
+// Planner, get commands back. A Planner keeps no per-track state, so one
+// instance can be shared by any number of threads planning at once.
+// -----------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum RobotOrientation {
+    UP,
+    RIGHT,
+    DOWN,
+    LEFT
+};
+
+enum PositionType {
+    CENTER,
+    MID_TOP,
+    MID_RIGHT,
+    MID_BOTTOM,
+    MID_LEFT,
+    CORNER_TOP_LEFT,
+    CORNER_TOP_RIGHT,
+    CORNER_BOTTOM_LEFT,
+    CORNER_BOTTOM_RIGHT
+};
+
+// Everything the robot can do in one command
+enum MotionPrimitive {
+    PRIM_FORWARD,
+    PRIM_BACKWARD,
+    PRIM_LEFT,
+    PRIM_RIGHT,
+    PRIM_TURN_LEFT,
+    PRIM_TURN_RIGHT,
+    NUM_PRIMITIVES
+};
+
+// "hasn't moved yet" in place of a last primitive
+const int NO_PRIM = NUM_PRIMITIVES;
+
+extern const char* PRIMITIVE_NAME[NUM_PRIMITIVES];
+
+constexpr bool isTurn(int prim) { return prim == PRIM_TURN_LEFT || prim == PRIM_TURN_RIGHT; }
+
+// cell step for each RobotOrientation (UP, RIGHT, DOWN, LEFT)
+constexpr int DIR_DX[4] = { 0, 1, 0, -1 };
+constexpr int DIR_DY[4] = { -1, 0, 1, 0 };
+
+// where each PositionType sits, in half-cells from the cell center
+constexpr int POSITION_DX[9] = { 0, 0, 1, 0, -1, -1, 1, -1, 1 };
+constexpr int POSITION_DY[9] = { 0, -1, 0, 1, 0, -1, -1, 1, 1 };
+
+// Frame transforms. MOVE_DIR[heading][prim] is the world direction a move
+// goes facing `heading`; MOVE_PRIM[heading][dir] is the move that goes that
+// way. Only the four translations have entries.
+constexpr int PRIMITIVE_DIR_OFFSET[4] = { 0, 2, 3, 1 };  // forward, backward, left, right
+
+struct MoveTables {
+    int dir[4][4];
+    int prim[4][4];
+};
+
+constexpr MoveTables buildMoveTables() {
+    MoveTables t{};
+    for (int h = 0; h < 4; h++) {
+        for (int p = 0; p < 4; p++) {
+            int d = (h + PRIMITIVE_DIR_OFFSET[p]) % 4;
+            t.dir[h][p] = d;
+            t.prim[h][d] = p;
+        }
+    }
+    return t;
+}
+
+constexpr MoveTables MOVE_TABLES = buildMoveTables();
+constexpr int moveDir(int heading, int prim) { return MOVE_TABLES.dir[heading][prim]; }
+constexpr int movePrim(int heading, int dir) { return MOVE_TABLES.prim[heading][dir]; }
+
+// -----------------------------------------------------------------------------
+// One robot command: a primitive plus a fixed-point distance. The planner
+// only ever handles these; "forward(2.5)" text is made at the output
+// (commandText) for printing and the sketch.
+const int CELL_UNITS = 100;           // distance units per cell
+const int HALF_CELL = CELL_UNITS / 2;
+
+struct MotionCommand {
+    uint8_t prim;                     // MotionPrimitive
+    uint16_t distance;                // cells * CELL_UNITS, 0 for turns
+};
+
+constexpr MotionCommand motion(int prim, int distance) {
+    return { (uint8_t)prim, (uint16_t)distance };
+}
+
+// one search step: a whole cell, or a quarter turn
+constexpr MotionCommand unitMotion(int prim) {
+    return motion(prim, isTurn(prim) ? 0 : CELL_UNITS);
+}
+
+inline double commandCells(const MotionCommand& c) { return (double)c.distance / CELL_UNITS; }
+
+bool operator==(const MotionCommand& a, const MotionCommand& b);
+
+std::string commandText(const MotionCommand& c);
+std::vector<std::string> commandTexts(const std::vector<MotionCommand>& commands);
+
+struct RobotState {
+    int gridX = 0;
+    int gridY = 0;
+    PositionType positionType = CENTER;
+    RobotOrientation orientation = UP;
+    bool valid = false;
+};
+
+// -----------------------------------------------------------------------------
+// Time cost model. The planner minimizes predicted seconds, not cells.
+// Move defaults match fwd/bwd/rt/lt/trn in the sketches; measure the real robot
+// and put the numbers in calibration.txt (see loadCostModel).
+struct CostModel {
+    double moveSec[NUM_PRIMITIVES] = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };  // per cell / per 90 deg turn
+    double stopSec = 1.0;              // standing still between commands; the sketch
+                                       // dwells per step, paceCommands sets its dwellMs
+    double directionChangeSec = 0.0;   // extra settling when the move type changes
+
+    // For pacing: moveSec was measured at calibrationPwm, and a move may be
+    // slowed down as far as minPwm. Time taken goes with 1 / PWM.
+    int calibrationPwm = 255;
+    int minPwm[NUM_PRIMITIVES] = { 180, 180, 180, 180, 255, 255 };
+
+    double commandSec(int prim, double cells, int lastPrim) const {
+        double sec = moveSec[prim] * cells + stopSec;
+        if (lastPrim != NO_PRIM && lastPrim != prim) {
+            sec += directionChangeSec;
+        }
+        return sec;
+    }
+
+    // one cell (or turn) in whole milliseconds, for the searches; `cells` is
+    // 0.5 for the half-steps at either end. When moves get merged, repeating
+    // the last move just extends its segment: no stop.
+    int stepMs(int prim, int lastPrim, bool coalesceMoves, double cells = 1.0) const;
+};
+
+// Reads "key = seconds" lines, # starts a comment. Keys: forward, backward,
+// left, right, turn, stop, direction_change, and for pacing pwm, min_pwm
+// (the four moves), min_pwm_turn. Missing keys keep their default.
+bool loadCostModel(const std::string& path, CostModel& model);
+
+// -----------------------------------------------------------------------------
+// A track layout. Cell (x, y) is index y * gSize + x. Walls are packed 64 per
+// word using the same index:
+//   vertical bit   = wall between (x, y) and (x+1, y)
+//   horizontal bit = wall between (x, y) and (x, y+1)
+// openDirs keeps a 4-bit mask per cell (bit = RobotOrientation) of the sides
+// you can leave through. Change walls through the methods so it stays in sync.
+struct Track {
+    int gSize = 0;
+    std::vector<uint64_t> verticalWalls;
+    std::vector<uint64_t> horizontalWalls;
+    std::vector<uint8_t> openDirs;
+
+    std::vector<std::pair<int,int>> checkpoints;
+    std::pair<int,int> endCheckpoint = { -1, -1 };
+    RobotState robotStartState;
+    RobotState robotEndState;
+
+    explicit Track(int size = 4);
+
+    bool hasVerticalWall(int x, int y) const;
+    bool hasHorizontalWall(int x, int y) const;
+    void toggleVerticalWall(int x, int y);
+    void toggleHorizontalWall(int x, int y);
+    bool isWallBetween(int x1, int y1, int x2, int y2) const;
+};
+
+// -----------------------------------------------------------------------------
+struct PlannerOptions {
+    // let the robot turn in place instead of strafing everything from the start heading
+    bool allowTurns = true;
+    // merge runs of the same move into one command (forward(1) forward(1) -> forward(2))
+    bool coalesceMoves = true;
+    // how long branch-and-bound / local search may run before we take their best tour
+    int searchTimeBudgetMs = 3000;
+    CostModel costModel;
+};
+
+struct PlanStats {
+    long long bfsRuns = 0;
+    long long workspaceAllocations = 0;
+    long long nodesExpanded = 0;       // cells / search states taken off a queue
+    const char* solver = "";
+    double elapsedMs = 0;
+};
+
+// Structure for BFS permutations among checkpoints
+struct PermResult {
+    double dist;                      // predicted seconds, the route's own, not the matrix's
+    std::vector<std::pair<int,int>> finalPath;
+    std::vector<std::pair<int,int>> waypoints;  // start, checkpoints in order, end checkpoint, robot end
+    bool provenOptimal = true;        // only if no other order can be faster
+    PlanStats stats;
+};
+
+struct PlanResult {
+    bool found = false;
+    std::string error;                // why nothing was found
+    std::vector<MotionCommand> commands;
+    std::vector<std::pair<int,int>> path;
+    std::vector<std::pair<int,int>> waypoints;
+    double totalDistance = 0;         // cells driven
+    double predictedSeconds = 0;
+    bool provenOptimal = true;
+    bool cancelled = false;           // stopped through PlanProgress::cancel
+    PlanStats stats;
+};
+
+// Lets another thread follow a plan and stop it. The planner polls `cancel`
+// between chunks of work and bumps the counters as it goes; nothing here
+// takes a lock.
+struct PlanProgress {
+    std::atomic<bool> cancel{false};
+    std::atomic<int> legsSearched{0};  // timed searches done for the distance matrix
+    std::atomic<int> legsTotal{0};
+    std::atomic<int> bestTourMs{-1};   // best order found so far, -1 until there is one
+    // Called on the planning thread each time the order gets better, with
+    // start, checkpoints in order, end checkpoint, robot end.
+    std::function<void(const std::vector<std::pair<int,int>>& waypoints, double seconds)> onBetterTour;
+};
+
+struct PlanContext;
+
+class Planner {
+public:
+    explicit Planner(const PlannerOptions& options = PlannerOptions());
+    ~Planner();
+
+    const PlannerOptions& options() const { return opts; }
+
+    // The whole pipeline: checkpoint order, route, commands. With progress
+    // set the plan can be watched and cancelled from another thread.
+    PlanResult plan(const Track& track, PlanProgress* progress = nullptr);
+
+    // The pieces, for tools and benchmarks.
+    std::vector<std::pair<int,int>> shortestPathBetween(const Track& track,
+                                                        std::pair<int,int> start,
+                                                        std::pair<int,int> goal);
+    PermResult findBestPermutation(const Track& track);
+    std::vector<MotionCommand> pathToCommands(const Track& track,
+                                            const std::vector<std::pair<int,int>>& path,
+                                            RobotOrientation ori) const;
+
+    // totals over every call so far
+    long long totalBfsRuns() const { return bfsRuns; }
+    long long totalWorkspaceAllocations() const { return workspaceAllocations; }
+    long long totalNodesExpanded() const { return nodesExpanded; }
+
+    struct WorkspacePool;
+
+private:
+    PlannerOptions opts;
+    std::unique_ptr<WorkspacePool> pool;
+    std::atomic<long long> bfsRuns{0};
+    std::atomic<long long> workspaceAllocations{0};
+    std::atomic<long long> nodesExpanded{0};
+
+    void addStats(const PlanContext& ctx);
+    void finishStats(PlanContext& ctx, std::chrono::steady_clock::time_point started, PlanStats& stats);
+    bool checkTrack(const PlanContext& ctx, PlanResult& result) const;
+    void finishPlan(PlanContext& ctx, const PermResult& best, PlanResult& result) const;
+    bool checkCancelled(const PlanContext& ctx, PlanResult& result) const;
+
+    friend class IncrementalPlanner;
+};
+
+// -----------------------------------------------------------------------------
+// Keeps the leg-time searches of the last plan and repairs them after each
+// edit instead of starting over. An opened wall only lowers costs, so those
+// are pushed forward from the two cells; a closed wall re-settles just the
+// states whose best route went through it. The checkpoint order is solved
+// again only when a changed leg could beat the last optimal tour.
+struct IncrementalStats {
+    int sourcesSearched = 0;          // full searches for new start/checkpoint cells
+    int sourcesRepaired = 0;          // searches patched after a wall edit
+    long long statesRepaired = 0;     // states those patches touched
+    bool orderReused = false;         // the last checkpoint order still won
+};
+
+class IncrementalPlanner {
+public:
+    explicit IncrementalPlanner(Planner& planner);
+    ~IncrementalPlanner();
+
+    // Takes the new layout. Walls that differ from the last one are repaired
+    // edge by edge; a new grid size (or a pile of changes) starts over.
+    void setTrack(const Track& track);
+    const Track& track() const;
+
+    // Like Planner::plan. A cancelled plan keeps the repaired searches but
+    // drops any it had only half done.
+    PlanResult plan(PlanProgress* progress = nullptr);
+
+    // what plan() reused, counting the edits since the plan before it
+    const IncrementalStats& lastStats() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// -----------------------------------------------------------------------------
+// Command helpers
+
+// Half-steps between a cell's center and one of its 9 positions, for a
+// robot facing `ori`. At most one drive and one strafe.
+struct PartialSteps {
+    int count;
+    MotionCommand steps[2];
+};
+
+const PartialSteps& partialStepsFromPosTypeToCenter(PositionType posType, RobotOrientation ori);
+const PartialSteps& partialStepsFromCenterToPosType(PositionType posType, RobotOrientation ori);
+// false if a half-step leaves the grid or runs along a wall
+bool canDoPartialStepsToCenter(const Track& track, int x, int y, PositionType posType, RobotOrientation ori);
+bool canDoPartialStepsFromCenter(const Track& track, int x, int y, PositionType posType, RobotOrientation ori);
+std::vector<MotionCommand> coalesceCommands(const std::vector<MotionCommand>& commands);
+double predictedSeconds(const std::vector<MotionCommand>& commands, const CostModel& model);
+double commandDistance(const std::vector<MotionCommand>& commands);
+
+// -----------------------------------------------------------------------------
+// Pacing. Robot Tour scores how close the run time lands to a target, so once
+// the route is fixed every command gets a PWM and a dwell that stretch the
+// predicted run to the target. Moves are slowed first, all by the same
+// factor down to their minPwm (slower drives slip less); what is left is
+// spent standing still at the stops between commands, never after the last.
+struct TimedCommand {
+    MotionCommand command;
+    uint8_t pwm;                      // 0..255
+    uint16_t driveMs;                 // motors on
+    uint16_t dwellMs;                 // stopped afterwards, stop settling included
+};
+
+struct PacedSchedule {
+    std::vector<TimedCommand> steps;
+    double predictedSeconds = 0;
+    bool onTarget = false;            // false if the target can't be reached, see error
+    std::string error;
+};
+
+// targetSeconds <= 0: no target, everything at the calibrated speed
+PacedSchedule paceCommands(const std::vector<MotionCommand>& commands, const CostModel& model,
+                           double targetSeconds);
+
+// "{ 'w', 180, 2310, 1200 },  // forward(2.5)", a line of the sketch's schedule[]
+std::string timedCommandText(const TimedCommand& c);
@@ -0,0 +1,412 @@
+#include "track_file.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char* POSITION_NAME[] = {
+    "center", "mid_top", "mid_right", "mid_bottom", "mid_left",
+    "corner_top_left", "corner_top_right", "corner_bottom_left", "corner_bottom_right"
+};
+const int NUM_POSITIONS = 9;
+
+const char* ORIENTATION_NAME[4] = { "up", "right", "down", "left" };
+
+int lookupName(const char* const* names, int count, const string& name) {
+    for (int i = 0; i < count; i++) {
+        if (name == names[i]) return i;
+    }
+    return -1;
+}
+
+size_t recordBytes(int gSize, int numCheckpoints) {
+    size_t wallWords = (size_t(gSize) * gSize + 63) / 64;
+    size_t bytes = sizeof(TrackRecord) + 2 * wallWords * sizeof(uint64_t)
+                   + 2 * numCheckpoints * sizeof(uint16_t);
+    return (bytes + 7) & ~size_t(7);
+}
+
+// What loadTrackText would have refused in a record whose sizes are already
+// checked, or nullptr: everything has to be on the grid and a known enum.
+const char* recordProblem(const TrackRecord* rec) {
+    TrackView view(rec);
+    int n = rec->gSize;
+    auto onGrid = [n](pair<int,int> xy) { return xy.first >= 0 && xy.first < n && xy.second >= 0 && xy.second < n; };
+    if (n > 255) return "bad size";
+    for (int i = 0; i < view.numCheckpoints(); i++) {
+        if (!onGrid(view.checkpoint(i))) return "checkpoint off the grid";
+    }
+    if (view.endCheckpoint() != make_pair(-1, -1) && !onGrid(view.endCheckpoint())) return "end checkpoint off the grid";
+    if (!onGrid({ rec->start[0], rec->start[1] }) || !onGrid({ rec->end[0], rec->end[1] })) return "start or end off the grid";
+    if (rec->startPosition >= NUM_POSITIONS || rec->endPosition >= NUM_POSITIONS) return "unknown position";
+    if (rec->startOrientation >= 4) return "unknown orientation";
+    return nullptr;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Text format
+bool saveTrackText(const string& path, const Track& track) {
+    ofstream out(path);
+    if (!out) {
+        cout << "track file: can't write " << path << "\n";
+        return false;
+    }
+
+    const RobotState& start = track.robotStartState;
+    const RobotState& end = track.robotEndState;
+    out << "# Robot Tour track\n";
+    out << "size " << track.gSize << "\n";
+    if (start.valid) {
+        out << "start " << start.gridX << " " << start.gridY << " "
+            << POSITION_NAME[start.positionType] << " " << ORIENTATION_NAME[start.orientation] << "\n";
+    }
+    if (end.valid) {
+        out << "end " << end.gridX << " " << end.gridY << " " << POSITION_NAME[end.positionType] << "\n";
+    }
+    for (auto [x, y] : track.checkpoints) {
+        out << "checkpoint " << x << " " << y << "\n";
+    }
+    if (track.endCheckpoint.first >= 0) {
+        out << "end_checkpoint " << track.endCheckpoint.first << " " << track.endCheckpoint.second << "\n";
+    }
+    for (int y = 0; y < track.gSize; y++) {
+        for (int x = 0; x < track.gSize; x++) {
+            if (x < track.gSize - 1 && track.hasVerticalWall(x, y)) out << "vwall " << x << " " << y << "\n";
+            if (y < track.gSize - 1 && track.hasHorizontalWall(x, y)) out << "hwall " << x << " " << y << "\n";
+        }
+    }
+    return (bool)out;
+}
+
+bool loadTrackText(const string& path, Track& track) {
+    ifstream in(path);
+    if (!in) {
+        cout << "track file: can't open " << path << "\n";
+        return false;
+    }
+
+    Track loaded(0);
+    bool haveSize = false;
+    string line;
+    int lineNo = 0;
+    auto fail = [&](const string& why) {
+        cout << "track file: " << path << ":" << lineNo << ": " << why << "\n";
+        return false;
+    };
+
+    while (getline(in, line)) {
+        lineNo++;
+        istringstream fields(line.substr(0, line.find('#')));
+        string key;
+        if (!(fields >> key)) continue;
+
+        if (key == "size") {
+            int size = 0;
+            if (haveSize) return fail("size given twice");
+            if (!(fields >> size) || size < 2 || size > 255) return fail("bad size");
+            loaded = Track(size);
+            haveSize = true;
+            continue;
+        }
+        if (!haveSize) return fail("size has to come first");
+
+        int x, y;
+        if (!(fields >> x >> y)) return fail("expected x y after " + key);
+        if (x < 0 || x >= loaded.gSize || y < 0 || y >= loaded.gSize) return fail("cell off the grid");
+
+        if (key == "start" || key == "end") {
+            RobotState& state = key == "start" ? loaded.robotStartState : loaded.robotEndState;
+            string position, orientation;
+            fields >> position;
+            int pos = lookupName(POSITION_NAME, NUM_POSITIONS, position);
+            if (pos < 0) return fail("unknown position " + position);
+            state.gridX = x;
+            state.gridY = y;
+            state.positionType = (PositionType)pos;
+            state.valid = true;
+            if (key == "start") {
+                fields >> orientation;
+                int ori = lookupName(ORIENTATION_NAME, 4, orientation);
+                if (ori < 0) return fail("unknown orientation " + orientation);
+                state.orientation = (RobotOrientation)ori;
+            }
+        }
+        else if (key == "checkpoint") {
+            loaded.checkpoints.emplace_back(x, y);
+        }
+        else if (key == "end_checkpoint") {
+            loaded.endCheckpoint = { x, y };
+        }
+        else if (key == "vwall" || key == "hwall") {
+            bool vertical = key == "vwall";
+            if ((vertical ? x : y) >= loaded.gSize - 1) return fail("wall on the grid border");
+            if (vertical ? loaded.hasVerticalWall(x, y) : loaded.hasHorizontalWall(x, y)) continue;
+            if (vertical) loaded.toggleVerticalWall(x, y);
+            else          loaded.toggleHorizontalWall(x, y);
+        }
+        else {
+            return fail("unknown key " + key);
+        }
+    }
+
+    if (!haveSize) {
+        cout << "track file: " << path << " has no size\n";
+        return false;
+    }
+    // same rule as the editor: the end checkpoint isn't also a normal one
+    loaded.checkpoints.erase(remove(loaded.checkpoints.begin(), loaded.checkpoints.end(), loaded.endCheckpoint),
+                             loaded.checkpoints.end());
+    track = move(loaded);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Binary corpus
+bool saveTrackCorpus(const string& path, const vector<Track>& tracks) {
+    ofstream out(path, ios::binary);
+    if (!out) {
+        cout << "track file: can't write " << path << "\n";
+        return false;
+    }
+
+    TrackCorpusHeader header;
+    memcpy(header.magic, TRACK_CORPUS_MAGIC, 4);
+    header.version = TRACK_CORPUS_VERSION;
+    header.count = tracks.size();
+
+    vector<uint64_t> offsets(tracks.size());
+    uint64_t offset = sizeof(header) + tracks.size() * sizeof(uint64_t);
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks[i].checkpoints.size() > 0xFFFF) {
+            cout << "track file: too many checkpoints in track " << i << "\n";
+            return false;
+        }
+        offsets[i] = offset;
+        offset += recordBytes(tracks[i].gSize, (int)tracks[i].checkpoints.size());
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+
+    vector<uint8_t> buf;
+    for (const Track& t : tracks) {
+        int n = (int)t.checkpoints.size();
+        int wallWords = (t.gSize * t.gSize + 63) / 64;
+        buf.assign(recordBytes(t.gSize, n), 0);
+
+        TrackRecord rec = {};
+        rec.bytes = (uint32_t)buf.size();
+        rec.gSize = (uint16_t)t.gSize;
+        rec.numCheckpoints = (uint16_t)n;
+        rec.endCheckpoint[0] = (int16_t)t.endCheckpoint.first;
+        rec.endCheckpoint[1] = (int16_t)t.endCheckpoint.second;
+        rec.start[0] = (uint16_t)t.robotStartState.gridX;
+        rec.start[1] = (uint16_t)t.robotStartState.gridY;
+        rec.end[0] = (uint16_t)t.robotEndState.gridX;
+        rec.end[1] = (uint16_t)t.robotEndState.gridY;
+        rec.startPosition = (uint8_t)t.robotStartState.positionType;
+        rec.startOrientation = (uint8_t)t.robotStartState.orientation;
+        rec.endPosition = (uint8_t)t.robotEndState.positionType;
+        rec.flags = (t.robotStartState.valid ? TRACK_START_VALID : 0) | (t.robotEndState.valid ? TRACK_END_VALID : 0);
+
+        uint8_t* p = buf.data();
+        memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+        memcpy(p, t.verticalWalls.data(), wallWords * sizeof(uint64_t));
+        p += wallWords * sizeof(uint64_t);
+        memcpy(p, t.horizontalWalls.data(), wallWords * sizeof(uint64_t));
+        p += wallWords * sizeof(uint64_t);
+        for (auto [x, y] : t.checkpoints) {
+            uint16_t xy[2] = { (uint16_t)x, (uint16_t)y };
+            memcpy(p, xy, sizeof(xy));
+            p += sizeof(xy);
+        }
+        out.write((const char*)buf.data(), buf.size());
+    }
+    return (bool)out;
+}
+
+bool saveTrackBinary(const string& path, const Track& track) {
+    return saveTrackCorpus(path, { track });
+}
+
+bool loadTrack(const string& path, Track& track) {
+    char magic[4] = {};
+    {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            cout << "track file: can't open " << path << "\n";
+            return false;
+        }
+        in.read(magic, 4);
+    }
+    if (memcmp(magic, TRACK_CORPUS_MAGIC, 4) != 0) {
+        return loadTrackText(path, track);
+    }
+
+    TrackCorpus corpus;
+    if (!corpus.open(path)) {
+        return false;
+    }
+    if (corpus.size() != 1) {
+        cout << "track file: " << path << " holds " << corpus.size() << " tracks, expected 1\n";
+        return false;
+    }
+    track = corpus[0].toTrack();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// TrackView
+RobotState TrackView::robotStartState() const {
+    RobotState s;
+    s.gridX = rec->start[0];
+    s.gridY = rec->start[1];
+    s.positionType = (PositionType)rec->startPosition;
+    s.orientation = (RobotOrientation)rec->startOrientation;
+    s.valid = rec->flags & TRACK_START_VALID;
+    return s;
+}
+
+RobotState TrackView::robotEndState() const {
+    RobotState s;
+    s.gridX = rec->end[0];
+    s.gridY = rec->end[1];
+    s.positionType = (PositionType)rec->endPosition;
+    s.valid = rec->flags & TRACK_END_VALID;
+    return s;
+}
+
+Track TrackView::toTrack() const {
+    Track t(gSize());
+    for (int y = 0; y < gSize(); y++) {
+        for (int x = 0; x < gSize(); x++) {
+            if (x < gSize() - 1 && hasVerticalWall(x, y)) t.toggleVerticalWall(x, y);
+            if (y < gSize() - 1 && hasHorizontalWall(x, y)) t.toggleHorizontalWall(x, y);
+        }
+    }
+    t.checkpoints.reserve(numCheckpoints());
+    for (int i = 0; i < numCheckpoints(); i++) {
+        t.checkpoints.push_back(checkpoint(i));
+    }
+    t.endCheckpoint = endCheckpoint();
+    t.robotStartState = robotStartState();
+    t.robotEndState = robotEndState();
+    return t;
+}
+
+// -----------------------------------------------------------------------------
+// TrackCorpus
+TrackCorpus::~TrackCorpus() {
+    close();
+}
+
+TrackView TrackCorpus::operator[](size_t i) const {
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data + sizeof(TrackCorpusHeader));
+    return TrackView(reinterpret_cast<const TrackRecord*>(data + offsets[i]));
+}
+
+bool TrackCorpus::open(const string& path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        cout << "track file: can't open " << path << "\n";
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    length = (size_t)fileSize.QuadPart;
+    fileHandle = file;
+    if (length > 0) {
+        mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle) {
+            data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cout << "track file: can't open " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    length = (size_t)st.st_size;
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = (const uint8_t*)mapped;
+        }
+    }
+    ::close(fd);  // the mapping keeps the file alive
+#endif
+
+    auto fail = [&](const char* why) {
+        cout << "track file: " << path << ": " << why << "\n";
+        close();
+        return false;
+    };
+
+    if (!data) return fail("can't map file");
+    if (length < sizeof(TrackCorpusHeader)) return fail("too short");
+
+    const TrackCorpusHeader* header = reinterpret_cast<const TrackCorpusHeader*>(data);
+    if (memcmp(header->magic, TRACK_CORPUS_MAGIC, 4) != 0) return fail("not a track corpus");
+    if (header->version != TRACK_CORPUS_VERSION) return fail("unsupported version");
+    if (header->count > (length - sizeof(TrackCorpusHeader)) / sizeof(uint64_t)) return fail("truncated offset table");
+
+    // every record has to fit and agree with its own sizes, so TrackView
+    // never reads past the end, and hold a track the planner can index with
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data + sizeof(TrackCorpusHeader));
+    for (uint64_t i = 0; i < header->count; i++) {
+        uint64_t off = offsets[i];
+        if (off % 8 != 0 || off > length || length - off < sizeof(TrackRecord)) return fail("bad record offset");
+        const TrackRecord* rec = reinterpret_cast<const TrackRecord*>(data + off);
+        if (rec->gSize < 2 || rec->bytes != recordBytes(rec->gSize, rec->numCheckpoints)
+            || rec->bytes > length - off) {
+            return fail("bad record");
+        }
+        if (const char* why = recordProblem(rec)) {
+            cout << "track file: " << path << ": track " << i << ": " << why << "\n";
+            close();
+            return false;
+        }
+    }
+    count = header->count;
+    return true;
+}
+
+void TrackCorpus::close() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data) munmap((void*)data, length);
+#endif
+    data = nullptr;
+    length = 0;
+    count = 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Track files.
+//
+// Text (.txt), one item per line, # starts a comment:
+//   size 5
+//   start 0 4 mid_bottom up          x y position orientation
+//   end 4 0 center                   x y position
+//   checkpoint 2 2
+//   end_checkpoint 4 4
+//   vwall 1 3                        wall between (1, 3) and (2, 3)
+//   hwall 0 0                        wall between (0, 0) and (0, 1)
+//
+// Binary (.rtb) is a corpus: a header, an offset table and one TrackRecord
+// per track, everything 8-byte aligned so a memory-mapped file can be read
+// in place. A single saved track is just a corpus of one. Fields are stored
+// in host byte order (little-endian on everything we build for).
+// -----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "planner.h"
+
+const char TRACK_CORPUS_MAGIC[4] = { 'R', 'T', 'C', 'P' };
+const uint32_t TRACK_CORPUS_VERSION = 1;
+
+struct TrackCorpusHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    // followed by uint64_t offsets[count], from the start of the file
+};
+
+// Walls come first so they stay aligned:
+//   uint64_t verticalWalls[wallWords]
+//   uint64_t horizontalWalls[wallWords]
+//   uint16_t checkpoints[numCheckpoints][2]
+// then padding up to `bytes`.
+struct TrackRecord {
+    uint32_t bytes;              // whole record, multiple of 8
+    uint16_t gSize;
+    uint16_t numCheckpoints;
+    int16_t endCheckpoint[2];    // -1 -1 if not set
+    uint16_t start[2];
+    uint16_t end[2];
+    uint8_t startPosition;
+    uint8_t startOrientation;
+    uint8_t endPosition;
+    uint8_t flags;               // TRACK_START_VALID | TRACK_END_VALID
+};
+
+const uint8_t TRACK_START_VALID = 1;
+const uint8_t TRACK_END_VALID = 2;
+
+// Read-only look at one record, straight from the mapped file.
+class TrackView {
+public:
+    explicit TrackView(const TrackRecord* rec) : rec(rec) {}
+
+    int gSize() const { return rec->gSize; }
+    int wallWords() const { return (rec->gSize * rec->gSize + 63) / 64; }
+    bool hasVerticalWall(int x, int y) const { return wallBit(verticalWalls(), y * rec->gSize + x); }
+    bool hasHorizontalWall(int x, int y) const { return wallBit(horizontalWalls(), y * rec->gSize + x); }
+
+    int numCheckpoints() const { return rec->numCheckpoints; }
+    std::pair<int,int> checkpoint(int i) const { return { checkpointData()[2 * i], checkpointData()[2 * i + 1] }; }
+    std::pair<int,int> endCheckpoint() const { return { rec->endCheckpoint[0], rec->endCheckpoint[1] }; }
+    RobotState robotStartState() const;
+    RobotState robotEndState() const;
+
+    // Copy into a Track (rebuilds the open masks) for planning.
+    Track toTrack() const;
+
+    const uint64_t* verticalWalls() const { return reinterpret_cast<const uint64_t*>(rec + 1); }
+    const uint64_t* horizontalWalls() const { return verticalWalls() + wallWords(); }
+
+private:
+    const TrackRecord* rec;
+
+    const uint16_t* checkpointData() const {
+        return reinterpret_cast<const uint16_t*>(horizontalWalls() + wallWords());
+    }
+    static bool wallBit(const uint64_t* words, int bit) { return (words[bit >> 6] >> (bit & 63)) & 1; }
+};
+
+// A memory-mapped .rtb file. open() checks the header, that every record
+// fits in the file and that its cells are on its grid (the same rules as
+// loadTrackText); after that tracks are read in place, nothing is parsed.
+class TrackCorpus {
+public:
+    TrackCorpus() = default;
+    ~TrackCorpus();
+    TrackCorpus(const TrackCorpus&) = delete;
+    TrackCorpus& operator=(const TrackCorpus&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    size_t size() const { return count; }
+    TrackView operator[](size_t i) const;
+
+    class iterator {
+    public:
+        iterator(const TrackCorpus* corpus, size_t i) : corpus(corpus), i(i) {}
+        TrackView operator*() const { return (*corpus)[i]; }
+        iterator& operator++() { i++; return *this; }
+        bool operator!=(const iterator& other) const { return i != other.i; }
+    private:
+        const TrackCorpus* corpus;
+        size_t i;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, count); }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    size_t count = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+bool saveTrackText(const std::string& path, const Track& track);
+bool loadTrackText(const std::string& path, Track& track);
+
+bool saveTrackCorpus(const std::string& path, const std::vector<Track>& tracks);
+bool saveTrackBinary(const std::string& path, const Track& track);
+
+// Text or binary, picked by the file's first bytes. A binary file must hold
+// exactly one track.
+bool loadTrack(const std::string& path, Track& track);
@@ -0,0 +1,104 @@
+#include "track_gen.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+int findRoot(vector<int>& parent, int a) {
+    while (parent[a] != a) {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+} // namespace
+
+Track generateTrack(const TrackGenParams& params) {
+    mt19937 rng(params.seed);
+    const int gSize = max(2, params.gSize);
+    Track track(gSize);
+
+    // inner edges: (cell, RIGHT) and (cell, DOWN), shuffled; Kruskal keeps a
+    // spanning tree open, the leftovers are wall candidates
+    vector<pair<int,int>> edges;
+    for (int y = 0; y < gSize; y++) {
+        for (int x = 0; x < gSize; x++) {
+            if (x < gSize - 1) edges.push_back({ y * gSize + x, RIGHT });
+            if (y < gSize - 1) edges.push_back({ y * gSize + x, DOWN });
+        }
+    }
+    shuffle(edges.begin(), edges.end(), rng);
+
+    vector<int> parent(gSize * gSize);
+    iota(parent.begin(), parent.end(), 0);
+    vector<pair<int,int>> spare;
+    for (auto [cell, dir] : edges) {
+        int other = cell + (dir == RIGHT ? 1 : gSize);
+        int a = findRoot(parent, cell);
+        int b = findRoot(parent, other);
+        if (a != b) {
+            parent[a] = b;
+        } else {
+            spare.push_back({ cell, dir });
+        }
+    }
+
+    int numWalls = min((int)spare.size(), (int)lround(params.wallDensity * edges.size()));
+    for (int i = 0; i < numWalls; i++) {
+        auto [cell, dir] = spare[i];
+        if (dir == RIGHT) track.toggleVerticalWall(cell % gSize, cell / gSize);
+        else              track.toggleHorizontalWall(cell % gSize, cell / gSize);
+    }
+
+    // start: any cell whose half-steps stay on the grid
+    RobotState& start = track.robotStartState;
+    start.positionType = params.startPosition;
+    start.orientation = (RobotOrientation)(rng() % 4);
+    start.valid = true;
+    vector<int> cells(gSize * gSize);
+    iota(cells.begin(), cells.end(), 0);
+    shuffle(cells.begin(), cells.end(), rng);
+    for (int cell : cells) {
+        if (canDoPartialStepsToCenter(track, cell % gSize, cell / gSize, start.positionType, start.orientation)) {
+            start.gridX = cell % gSize;
+            start.gridY = cell / gSize;
+            break;
+        }
+    }
+
+    // checkpoints, then the end checkpoint, from the other cells
+    int startCell = start.gridY * gSize + start.gridX;
+    cells.erase(remove(cells.begin(), cells.end(), startCell), cells.end());
+    shuffle(cells.begin(), cells.end(), rng);
+    int numCheckpoints = min(params.numCheckpoints, (int)cells.size() - 1);
+    for (int i = 0; i < numCheckpoints; i++) {
+        track.checkpoints.push_back({ cells[i] % gSize, cells[i] / gSize });
+    }
+    track.endCheckpoint = { cells[numCheckpoints] % gSize, cells[numCheckpoints] / gSize };
+
+    // end: the first cell from a random one whose end point isn't on a wall
+    RobotState& end = track.robotEndState;
+    end.positionType = params.endPosition;
+    end.valid = true;
+    int endCell = rng() % (gSize * gSize);
+    for (int i = 0; i < gSize * gSize; i++) {
+        int cell = (endCell + i) % (gSize * gSize);
+        bool reachable = false;
+        for (int h = 0; h < 4 && !reachable; h++) {
+            reachable = canDoPartialStepsFromCenter(track, cell % gSize, cell / gSize, end.positionType, (RobotOrientation)h);
+        }
+        if (reachable) {
+            endCell = cell;
+            break;
+        }
+    }
+    end.gridX = endCell % gSize;
+    end.gridY = endCell / gSize;
+    return track;
+}
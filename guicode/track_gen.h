@@ -0,0 +1,25 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Seeded random tracks for benchmarks and stress runs. The same params always
+// give the same track.
+// -----------------------------------------------------------------------------
+
+#include <cstdint>
+
+#include "planner.h"
+
+struct TrackGenParams {
+    int gSize = 5;
+    double wallDensity = 0.2;       // fraction of inner edges that get a wall
+    int numCheckpoints = 4;         // normal ones, the end checkpoint is extra
+    PositionType startPosition = MID_BOTTOM;
+    PositionType endPosition = CENTER;
+    uint32_t seed = 1;
+};
+
+// Every cell stays reachable: a random spanning tree of open edges is kept
+// and walls only go on the rest. The start cell is picked so its half-steps
+// to the center stay on the grid. Checkpoints are distinct and never on the
+// start cell.
+Track generateTrack(const TrackGenParams& params);